@@ -0,0 +1,61 @@
+/**
+ * @file adc.h
+ * @date 17.10.2026
+ * @author Denise Ratasich
+ *
+ * @brief Header of the ADC scanner.
+ *
+ * The ADC converts the requested channels one after another in free running
+ * mode (interrupt driven). Each channel is oversampled and decimated (4^n
+ * conversions per value, n additional bits), the values are buffered and
+ * low-pass filtered (IIR).
+ */
+
+#ifndef __ADC_H__
+#define __ADC_H__
+
+#include <avr/io.h>
+
+/** Maximum number of scanned channels. */
+#define ADC_MAX_CHANNELS        4
+/** Number of values buffered per channel. */
+#define ADC_BUFFER_SIZE         8
+/** Maximum oversampling (additional bits, 4^n conversions per value). */
+#define ADC_OVERSAMPLING_MAX    3
+/** Maximum filter shift of the IIR (alpha = 1/2^n). */
+#define ADC_FILTER_MAX          8
+
+/** Prescaler of the ADC clock (ADPSn: 7 .. 128, i.e., 125 kHz, about 9600
+ * conversions per second shared by the channels). */
+#define ADC_PRESCALER           7
+
+/** Initializes this module (the ADC runs as soon as a channel is
+ * requested). */
+void adc_init(void);
+
+/** Request a channel (0 .. 15, ADC0 .. ADC15) to be scanned with 4^n
+ * conversions per value (oversampling n: 0 .. ADC_OVERSAMPLING_MAX, the
+ * values have 10+n bits) and a low-pass filter with alpha = 1/2^filter (0
+ * .. off). Returns the number of the slot, -1 if there are too many
+ * channels. */
+int8_t adc_request(uint8_t channel, uint8_t oversampling, uint8_t filter);
+
+/** Release a slot, i.e., the channel is not scanned anymore. */
+void adc_release(int8_t slot);
+
+/** Returns the last value of a slot (10+n bits). */
+uint16_t adc_getLast(int8_t slot);
+
+/** Returns the low-pass filtered value of a slot (10+n bits). */
+uint16_t adc_getFiltered(int8_t slot);
+
+/** Returns the number of values not read yet. */
+uint8_t adc_available(int8_t slot);
+
+/** Reads the oldest value. Returns 0 if not available, 1 otherwise. */
+uint8_t adc_get(int8_t slot, uint16_t *value);
+
+/** Returns the number of values overwritten before being read. */
+uint16_t adc_overruns(int8_t slot);
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file capture.h
+ * @date 17.10.2026
+ * @author Denise Ratasich
+ *
+ * @brief Header of the input capture module (ICP4, ICP5).
+ *
+ * The time of an edge is latched by the hardware (Timer 4 or 5, 0.5us per
+ * count) and extended to 32 bit by counting the overflows of the timer
+ * (overflow after about 35 minutes).
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <avr/io.h>
+
+/** Number of edge times buffered per unit. */
+#define CAPTURE_BUFFER_SIZE     8
+/** Time without edges until the period is 0, i.e., stopped (in counts). */
+#define CAPTURE_TIMEOUT         1000000UL
+
+/** Counts per second (prescaler 8). */
+#define CAPTURE_COUNTS_PER_S    2000000UL
+
+enum capture_unit {
+  CAPTURE_UNIT_ICP4 = 0,
+  CAPTURE_UNIT_ICP5,
+  CAPTURE_UNIT_NUM
+};
+
+enum capture_edge {
+  CAPTURE_EDGE_FALLING = 0,
+  CAPTURE_EDGE_RISING
+};
+
+/** Initializes this module. */
+void capture_init(void);
+
+/** Request an input capture unit with the number of pulses per revolution
+ * (for capture_getRpm). Starts the timer of the unit. Returns -1 if the
+ * unit is used or its timer runs in PWM mode (see io.h). */
+int8_t capture_request(uint8_t unit, uint8_t edge, uint8_t pulsesPerRev);
+
+/** Release an input capture unit, i.e., stops its timer. */
+void capture_release(uint8_t unit);
+
+/** Returns the current time of a unit (counts). */
+uint32_t capture_getTime(uint8_t unit);
+
+/** Returns the number of edge times not read yet. */
+uint8_t capture_available(uint8_t unit);
+
+/** Reads the oldest edge time (counts). Returns 0 if not available, 1
+ * otherwise. */
+uint8_t capture_get(uint8_t unit, uint32_t *time);
+
+/** Returns the number of edge times overwritten before being read. */
+uint16_t capture_overruns(uint8_t unit);
+
+/** Returns the mean period of the buffered edges (counts), 0 if there are
+ * less than two edges or the last edge is older than CAPTURE_TIMEOUT. */
+uint32_t capture_getPeriod(uint8_t unit);
+
+/** Returns the frequency of the edges (mHz). */
+uint32_t capture_getFrequency(uint8_t unit);
+
+/** Returns the revolutions per minute. */
+uint32_t capture_getRpm(uint8_t unit);
+
+#endif
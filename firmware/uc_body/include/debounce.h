@@ -0,0 +1,39 @@
+/**
+ * @file debounce.h
+ * @date 17.10.2026
+ * @author Denise Ratasich
+ *
+ * @brief Header of the debounce module for buttons and switches on external
+ * interrupts.
+ *
+ * The first edge masks the external interrupt. After the settle time the
+ * level of the pin is checked (GPT) and the interrupt is enabled again. The
+ * callback is deferred to dispatch() and runs once per confirmed edge.
+ */
+
+#ifndef __DEBOUNCE_H__
+#define __DEBOUNCE_H__
+
+#include <avr/io.h>
+#include "extint.h" // trigger definitions
+
+/** Number of debounced inputs (INT0 .. INT7). */
+#define DEBOUNCE_NUM            8
+
+/** Initializes this module (extint, gpt and dispatch must be initialized). */
+void debounce_init(void);
+
+/** Request a debounced external interrupt. The trigger is one of
+ * EXTINT_TRIGGER_ANY_EDGE, _FALLING_EDGE or _RISING_EDGE, the settle time is
+ * given in ms. The callback is deferred to dispatch() with the given priority
+ * (see dispatch.h). Returns the external interrupt number or -1 on error. */
+int8_t debounce_request(int8_t no, uint8_t trigger, uint16_t settleTime,
+			uint8_t priority, void (*callback)(void));
+
+/** Release a debounced external interrupt. */
+void debounce_release(int8_t no);
+
+/** Returns the last confirmed level of a debounced input (0 or 1). */
+uint8_t debounce_getLevel(int8_t no);
+
+#endif
@@ -0,0 +1,41 @@
+/**
+ * @file encoder.h
+ * @date 17.10.2026
+ * @author Denise Ratasich
+ *
+ * @brief Header of the quadrature encoder of the DC motor.
+ *
+ * Every edge of channel A and B is counted (4 counts per encoder line). The
+ * velocity is estimated every ENCODER_SAMPLE_TIME ms: by the number of
+ * counts per sample time at high speed, by the time between edges at low
+ * speed.
+ */
+
+#ifndef __ENCODER_H__
+#define __ENCODER_H__
+
+#include <avr/io.h>
+
+/** Sample time of the velocity estimation (ms). */
+#define ENCODER_SAMPLE_TIME     10
+/** Priority of the velocity estimation (see dispatch.h). */
+#define ENCODER_PRIORITY        0
+
+/** Initializes pins and the pin change interrupt, starts the velocity
+ * estimation (gpt and dispatch must be initialized). */
+void encoder_init(void);
+
+/** Returns the position (counts). */
+int32_t encoder_getPosition(void);
+
+/** Sets the position (counts), e.g., after homing. */
+void encoder_setPosition(int32_t position);
+
+/** Returns the estimated velocity (counts/s). */
+int32_t encoder_getVelocity(void);
+
+/** Returns the number of invalid transitions (both channels changed, i.e.,
+ * edges were missed). */
+uint16_t encoder_errors(void);
+
+#endif
@@ -22,9 +22,25 @@ void extint_init();
 /** Request an external interrupt. */
 int8_t extint_requestInt(int8_t no, uint8_t trigger, void (*callback)(void));
 
+/** Request an external interrupt whose callback is deferred to dispatch()
+ * with the given priority (see dispatch.h). */
+int8_t extint_requestIntDeferred(int8_t no, uint8_t trigger, uint8_t priority,
+				 void (*callback)(void));
+
 /** Release an external interrupt, e.g., if not needed any more. */
 void extint_releaseInt(int8_t no);
 
+/** Masks a requested external interrupt (edges are ignored until enabled
+ * again). */
+void extint_disable(int8_t no);
+
+/** Unmasks a requested external interrupt. Edges which occurred while the
+ * interrupt was disabled are discarded. */
+void extint_enable(int8_t no);
+
+/** Returns the current level of the pin of an external interrupt (0 or 1). */
+uint8_t extint_getLevel(int8_t no);
+
 // external interrupt routines INT0 .. INT7
 
 #endif
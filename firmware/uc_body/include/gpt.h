@@ -13,10 +13,19 @@
 
 #define	GPT_MAX_TIMERS		10
 
+/** Tickless mode (1 .. on, 0 .. off). The compare match is set to the next
+ * deadline instead of interrupting every ms. Deadlines are then met with a
+ * jitter of one timer count (64us). */
+#define GPT_TICKLESS            0
+
 typedef struct {
   void (*callback)(void);
-  uint16_t overflowTime;
-  uint16_t remainingTime;
+  uint32_t overflowTime; // 0 .. unused
+  uint32_t delta; // ticks after expiry of predecessor in the expiry list
+  int8_t next; // next timer in the expiry list (-1 .. end of list)
+  uint8_t queued; // 1 .. timer is in the expiry list
+  int8_t event; // deferred callback event (-1 .. callback called in ISR)
+  uint8_t oneShot; // 1 .. not re-armed after expiry
 } GPTimerStruct_t;
 
 /** Initializes general purpose timer. */
@@ -26,11 +35,31 @@ void gpt_init();
  * want to count on your own. */
 uint32_t gpt_getTime();
 
-/** Request a GPT. */
-int8_t gpt_requestTimer(uint16_t overflowTime, void (*callback)(void));
+/** Returns current us from startup (overflow after about 71 minutes!). The
+ * resolution is 4us (64us in tickless mode). */
+uint32_t gpt_getTimeUs();
+
+/** Request a GPT. The overflow time (in ms) must be greater than 0. */
+int8_t gpt_requestTimer(uint32_t overflowTime, void (*callback)(void));
+
+/** Request a GPT whose callback is deferred to dispatch() with the given
+ * priority (see dispatch.h). */
+int8_t gpt_requestTimerDeferred(uint32_t overflowTime, uint8_t priority,
+				void (*callback)(void));
+
+/** Request a one-shot GPT expiring once after the given time (in ms). The
+ * timer keeps its slot after expiry, i.e., the id stays valid until the
+ * owner releases it with gpt_releaseTimer (also from the callback). Until
+ * then gpt_setOverflowTime or gpt_reset re-arm it. */
+int8_t gpt_requestOneShot(uint32_t time, void (*callback)(void));
+
+/** Request a one-shot GPT expiring at the given time from startup (in ms, see
+ * gpt_getTime). A deadline already passed expires with the next tick.
+ * The owner releases it like a timer of gpt_requestOneShot. */
+int8_t gpt_requestAt(uint32_t deadline, void (*callback)(void));
 
 /** Change overflow time of a GPT. */
-void gpt_setOverflowTime(uint16_t overflowTime, int8_t timerId);
+void gpt_setOverflowTime(uint32_t overflowTime, int8_t timerId);
 
 /** Resets the remaining time to overflow time of a GPT (for watchdog-like
  * usage). */
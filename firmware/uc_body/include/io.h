@@ -20,14 +20,17 @@
 #define FOSZ			16000000
 
 // Timer 2 as general purpose timer
+// Timer 0 generates the control period of the DC motor speed controllers
 
 // ---------------------------------------------------------------
 // external interrupts ports
 // ---------------------------------------------------------------
 #define EXTINTA_PORT    PORTD   // pin 0..3, INT0..3
 #define EXTINTA_DDR     DDRD
+#define EXTINTA_PIN     PIND
 #define EXTINTB_PORT    PORTE   // pin 4..7, INT4..7
 #define EXTINTB_DDR     DDRE
+#define EXTINTB_PIN     PINE
 
 // ----------------------------------------------------------------------
 // ports, pins, ADC-channels, etc.
@@ -39,6 +42,33 @@
 #define STEPPERMOTOR_A2		PA2 // green
 #define STEPPERMOTOR_B1		PA1 // black
 #define STEPPERMOTOR_B2		PA0 // yellow
+#define STEPPERMOTOR_HOME_INT   6 // INT6 (PE6), index switch (closes to GND)
+// Timer 3 generates the steps of moves (OC3x not available for PWM)
+// coils in microstep mode (PWM outputs, wired instead of PA3..0), timer 4
+// and 5 belong to the coils then, not to ICP4/ICP5 (see input capture)
+#define STEPPERMOTOR_PWM_A1     PWM_OC4A
+#define STEPPERMOTOR_PWM_A2     PWM_OC4B
+#define STEPPERMOTOR_PWM_B1     PWM_OC4C
+#define STEPPERMOTOR_PWM_B2     PWM_OC5A
+
+// PWM outputs (output compare channels of the 16-bit timers); a timer is
+// either used for PWM or for input capture (timer 4, 5)
+#define PWM_OC1_DDR             DDRB
+#define PWM_OC1A_PIN            PB5 // DC motor enable
+#define PWM_OC1B_PIN            PB6 // used by DC motor (IN2)
+#define PWM_OC1C_PIN            PB7 // used by DC motor (IN1)
+#define PWM_OC3_DDR             DDRE
+#define PWM_OC3A_PIN            PE3 // timer 3 used by stepper motor
+#define PWM_OC3B_PIN            PE4 // used by INT4
+#define PWM_OC3C_PIN            PE5 // used by INT5
+#define PWM_OC4_DDR             DDRH
+#define PWM_OC4A_PIN            PH3 // stepper motor A1 (microstep mode)
+#define PWM_OC4B_PIN            PH4 // stepper motor A2 (microstep mode)
+#define PWM_OC4C_PIN            PH5 // stepper motor B1 (microstep mode)
+#define PWM_OC5_DDR             DDRL
+#define PWM_OC5A_PIN            PL3 // stepper motor B2 (microstep mode)
+#define PWM_OC5B_PIN            PL4
+#define PWM_OC5C_PIN            PL5
 
 // DC motor
 #define MOTOR_PORT              PORTB
@@ -48,6 +78,31 @@
 #define MOTOR_ENA               PB5 // OC1A enable A
 // Timer 1 for PWM signal generation: OC1A
 
+// quadrature encoder of the DC motor (pin change interrupt PCINT2)
+#define ENCODER_PORT            PORTK
+#define ENCODER_DDR             DDRK
+#define ENCODER_PIN             PINK
+#define ENCODER_A               PK0 // PCINT16
+#define ENCODER_B               PK1 // PCINT17
+
+// input capture (e.g., tachometer of DC motor or dome rotation)
+#define CAPTURE_PORT            PORTL
+#define CAPTURE_DDR             DDRL
+#define CAPTURE_ICP4            PL0 // ICP4, owns timer 4
+#define CAPTURE_ICP5            PL1 // ICP5, owns timer 5
+// Timer 4 and 5 run freely as time base of the capture units. A timer is
+// either owned by its capture unit or used for PWM (e.g., the stepper coils
+// in microstep mode: A1..B1 on timer 4, B2 on timer 5), capture_request
+// fails on a timer in PWM mode.
+
+// analog inputs (ADC scanner), ADC0..7 on port F, ADC8..15 on port K
+// (ADC8, ADC9 used by the encoder)
+#define ADC_PORT_LOW            PORTF
+#define ADC_DDR_LOW             DDRF
+#define ADC_PORT_HIGH           PORTK
+#define ADC_DDR_HIGH            DDRK
+#define MOTOR_CURRENT_CHANNEL   0 // ADC0 (PF0), current sense of the DC motor
+
 // UART0 and UART1 pins are automatically controlled (so there are no
 // pin definitions needed)
 // RXD0: PE0, 
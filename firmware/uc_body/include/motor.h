@@ -4,23 +4,166 @@
  * @date 16.05.2016
  *
  * @brief Header of DC motor driver.
+ *
+ * Each motor is an instance (motor_t) with 2 bridge inputs on a port and an
+ * enable on a PWM output (see pwm.h). The output compare register of the
+ * enable is resolved at initialization. Changes of the bridge inputs and the
+ * duty cycle are committed together at a PWM period boundary, changes of
+ * several motors by the ramp or the speed controller in the same period.
  */
 
 #ifndef __MOTOR_H__
 #define __MOTOR_H__	
 
 #include <avr/io.h>	// e.g. uint16_t
+#include "pwm.h"
+
+/** Maximum number of motors. */
+#define MOTOR_MAX_INSTANCES     4
+
+/** Maximum length of the moving average of the ramp (as power of 2), i.e.,
+ * the longest time to reach the acceleration (ramp periods). */
+#define MOTOR_RAMP_AVERAGE_MAX  7
+
+/** Limits of the control rate of the speed controller (Hz). */
+#define MOTOR_CONTROL_RATE_MIN  1000
+#define MOTOR_CONTROL_RATE_MAX  5000
+
+/** Faults detected by the current sensing. */
+enum motor_fault {
+  MOTOR_FAULT_NONE = 0,
+  MOTOR_FAULT_OVERCURRENT,
+  MOTOR_FAULT_STALL
+};
+
+/** DC motor instance (members are private). */
+typedef struct {
+  // bridge
+  volatile uint8_t *port; // port of the bridge inputs
+  uint8_t in1; // bit mask of input 1
+  uint8_t in2; // bit mask of input 2
+  volatile uint16_t *ocr; // output compare register of the enable
+  uint8_t output; // PWM output of the enable (index, see pwm_index)
+  int16_t speed; // -PWM_TOP .. PWM_TOP
+  int8_t direction; // direction of the bridge (1 .. IN1 high, -1 .. IN2)
+  // ramp (open loop)
+  int16_t rampTarget; // set speed
+  int32_t ramp; // Q8.8
+  uint16_t rampStep; // Q8.8 per period (0 .. ramp off)
+  uint8_t rampShift; // moving average over 2^rampShift values
+  uint8_t rampIndex;
+  int16_t rampHistory[1 << MOTOR_RAMP_AVERAGE_MAX];
+  int32_t rampSum;
+  uint16_t brakeTime; // ms
+  uint16_t brakeCount; // remaining ramp periods to brake
+  uint8_t ramping;
+  // speed controller
+  int32_t (*feedback)(void); // position of the encoder
+  int32_t (*velocity)(void); // velocity of the encoder (optional)
+  volatile uint8_t controlEnabled;
+  volatile int32_t targetSpeed; // counts/s
+  volatile int32_t measuredSpeed; // counts/s
+  int16_t kp, ki, kd; // Q8.8
+  int32_t lastPosition;
+  int32_t lastSpeed;
+  int32_t integral; // Q8.8
+  int32_t derivative; // Q8.8
+  // current sensing
+  int8_t currentSlot; // ADC slot, -1 .. off
+  uint16_t currentLimit; // ADC value
+  uint16_t stallCurrent; // ADC value (filtered), 0 .. no stall detection
+  uint16_t stallTime; // ms
+  uint16_t stallPeriods; // control periods
+  uint16_t stallCount;
+  int32_t stallPosition;
+  volatile uint8_t fault; // enum motor_fault
+} motor_t;
 
-/** Initializes pins, position, mode. */
-void motor_init(void);
+/** Initializes pins and PWM of a motor: bridge inputs in1 and in2 (pin
+ * numbers) on a port and the enable on a PWM output. Returns 0 on success,
+ * -1 if there are too many motors. */
+int8_t motor_init(motor_t *motor, volatile uint8_t *port,
+		  volatile uint8_t *ddr, uint8_t in1, uint8_t in2,
+		  enum pwm_output enable);
+
+/** Sets speed of the motor (-PWM_TOP .. PWM_TOP). The speed is approached
+ * by the ramp, if configured (see motor_setRamp). */
+void motor_setSpeed(motor_t *motor, int16_t speed);
+
+/** Configures the ramp of motor_setSpeed, motor_inc and motor_dec:
+ * acceleration (PWM value per s, 0 .. ramp off, speed set at once), jerk
+ * (PWM value per s^2, 0 .. not limited) and the time the motor is braked
+ * when the direction reverses (ms, 0 .. coast through zero). The jerk is
+ * at most the given one, unless the acceleration takes longer than
+ * 2^MOTOR_RAMP_AVERAGE_MAX ramp periods to reach: then the ramp is set with
+ * the longest average (higher jerk) and -1 is returned, 0 otherwise. */
+int8_t motor_setRamp(motor_t *motor, uint16_t acceleration, uint16_t jerk,
+		     uint16_t brakeTime);
+
+/** Returns 1 while the ramp has not reached the set speed. */
+uint8_t motor_ramping(motor_t *motor);
 
 /** Changes speed of the motor. */
-void motor_inc(uint16_t step);
-void motor_dec(uint16_t step);
+void motor_inc(motor_t *motor, uint16_t step);
+void motor_dec(motor_t *motor, uint16_t step);
 
 /** Returns speed (including direction). */
-int16_t motor_getSpeed(void);
+int16_t motor_getSpeed(motor_t *motor);
 /** Returns direction, i.e., sign(speed). */
-int8_t motor_getDirection(void);
+int8_t motor_getDirection(motor_t *motor);
+
+/** Sets the feedback of the speed controller: position (counts), e.g.,
+ * encoder_getPosition, and velocity (counts/s, for a bumpless start, may be
+ * 0), e.g., encoder_getVelocity. */
+void motor_setFeedback(motor_t *motor, int32_t (*position)(void),
+		       int32_t (*velocity)(void));
+
+/** Enables the speed controller with a target speed (counts/s of the
+ * encoder), the feedback must be set. The controller is disabled by
+ * motor_setSpeed, motor_inc and motor_dec. */
+void motor_setTargetSpeed(motor_t *motor, int32_t target);
+
+/** Returns the target speed of the speed controller (counts/s). */
+int32_t motor_getTargetSpeed(motor_t *motor);
+
+/** Returns the speed measured by the speed controller (counts/s, filtered).
+ * Only updated while the controller is enabled. */
+int32_t motor_getMeasuredSpeed(motor_t *motor);
+
+/** Sets the gains of the PID speed controller (Q8.8, PWM value per count/s,
+ * ki and kd per control period). */
+void motor_setGains(motor_t *motor, int16_t kp, int16_t ki, int16_t kd);
+
+/** Sets the rate of the speed controllers of all motors
+ * (MOTOR_CONTROL_RATE_MIN .. MOTOR_CONTROL_RATE_MAX Hz). The control period
+ * is generated by timer 0, the actual rate is returned. */
+uint16_t motor_setControlRate(uint16_t rate);
+
+/** Returns the execution time of the last and the longest iteration of the
+ * speed controllers (all motors, us with a resolution of 4 us). */
+uint16_t motor_getControlTime(void);
+uint16_t motor_getControlTimeMax(void);
+
+/** Returns the number of iterations skipped, because the previous one did
+ * not finish within the control period. */
+uint16_t motor_controlOverruns(void);
+
+/** Enables the current sensing of a motor with an ADC slot (see
+ * adc_request, -1 .. off). The PWM is cut within a control period when the
+ * current exceeds the limit (overcurrent) or when the filtered current is
+ * above stallCurrent (0 .. off) for stallTime ms and the encoder (if set, see
+ * motor_setFeedback) does not move (stall). Currents are ADC values. */
+void motor_setCurrentSense(motor_t *motor, int8_t slot, uint16_t limit,
+			   uint16_t stallCurrent, uint16_t stallTime);
+
+/** Returns the filtered current (ADC value, 0 if not sensed). */
+uint16_t motor_getCurrent(motor_t *motor);
+
+/** Returns the fault (enum motor_fault). While a fault is set, the motor is
+ * stopped and new speeds are ignored. */
+uint8_t motor_getFault(motor_t *motor);
+
+/** Clears the fault, the motor accepts speeds again. */
+void motor_clearFault(motor_t *motor);
 
 #endif
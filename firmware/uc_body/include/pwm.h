@@ -3,7 +3,12 @@
  * @author Denise Ratasich
  * @date 16.05.2016
  *
- * @brief Header of DC motor driver.
+ * @brief Header of PWM driver.
+ *
+ * PWM signals on the output compare channels A, B and C of the 16-bit timers
+ * 1, 3, 4 and 5 (pins see io.h). An output is selected by an enum constant,
+ * so the inline functions below resolve to a direct register access (and the
+ * scaling of the duty cycle to TOP) when called with a constant.
  */
 
 #ifndef __PWM_H__
@@ -11,16 +16,137 @@
 
 #include <avr/io.h>	// e.g. uint16_t
 
+/** Full duty cycle of the API (values 0 .. PWM_TOP are scaled to the TOP
+ * of the timers, see pwm_getResolution). */
 #define PWM_TOP         (800)
 
+/** Number of outputs (index = bit position in enum pwm_output). */
+#define PWM_NUM_OUTPUTS         15
+/** Maximum number of ports with pins changed by a commit. */
+#define PWM_MAX_PORTS           4
+
+/** Output compare channels, 4 bits per timer (can be or'ed for pwm_init). */
 enum pwm_output {
-  PWM_OC1A = 0x01,
-  PWM_OC1B = 0x02,
-  PWM_OC1C = 0x04
+  PWM_OC1A = 0x0001,
+  PWM_OC1B = 0x0002,
+  PWM_OC1C = 0x0004,
+  PWM_OC3A = 0x0010,
+  PWM_OC3B = 0x0020,
+  PWM_OC3C = 0x0040,
+  PWM_OC4A = 0x0100,
+  PWM_OC4B = 0x0200,
+  PWM_OC4C = 0x0400,
+  PWM_OC5A = 0x1000,
+  PWM_OC5B = 0x2000,
+  PWM_OC5C = 0x4000
+};
+
+/** PWM modes. */
+enum pwm_mode {
+  PWM_MODE_FAST = 0, // single slope, TOP = ICRn
+  PWM_MODE_PHASE_CORRECT // dual slope, TOP = ICRn, half the frequency
 };
 
-/** Initializes timer 1 for fast PWM mode. */
-void pwm_init(uint8_t oc_mask);
+/** Initializes the timers of the given outputs (outputs are set to 0). All
+ * timers run with the same frequency (Hz) and mode. A frequency of 0 keeps
+ * the current frequency and mode (initially fast PWM with TOP = PWM_TOP, i.e., about 20
+ * kHz). Returns the effective frequency. */
+uint32_t pwm_init(uint16_t oc_mask, uint32_t frequency, enum pwm_mode mode);
+
+/** Changes frequency (Hz) and mode of all timers, the prescaler and TOP are
+ * calculated for the highest resolution. Current duty cycles are rescaled.
+ * Returns the effective frequency or 0 if not possible (nothing changed). */
+uint32_t pwm_setFrequency(uint32_t frequency, enum pwm_mode mode);
+
+/** Returns the effective frequency (Hz). */
+uint32_t pwm_getFrequency(void);
+
+/** Returns the resolution, i.e., the number of duty cycle steps (TOP). */
+uint16_t pwm_getResolution(void);
+
+/** Returns the current mode. */
+enum pwm_mode pwm_getMode(void);
+
+/** Duty cycles (0 .. PWM_TOP, index = bit position of the output) and their
+ * scale to TOP (Q16), private to the driver and its inline functions. */
+extern uint16_t pwmDuty[PWM_NUM_OUTPUTS];
+extern uint32_t pwmScale;
+
+/** Returns the bit position of an output (PWM_NUM_OUTPUTS if invalid). */
+static inline uint8_t pwm_index(enum pwm_output oc)
+{
+  switch (oc) {
+  case PWM_OC1A: return 0;
+  case PWM_OC1B: return 1;
+  case PWM_OC1C: return 2;
+  case PWM_OC3A: return 4;
+  case PWM_OC3B: return 5;
+  case PWM_OC3C: return 6;
+  case PWM_OC4A: return 8;
+  case PWM_OC4B: return 9;
+  case PWM_OC4C: return 10;
+  case PWM_OC5A: return 12;
+  case PWM_OC5B: return 13;
+  case PWM_OC5C: return 14;
+  }
+
+  return PWM_NUM_OUTPUTS;
+}
+
+/** Returns the output compare register of an output. */
+static inline volatile uint16_t* pwm_ocr(enum pwm_output oc)
+{
+  switch (oc) {
+  case PWM_OC1A: return &OCR1A;
+  case PWM_OC1B: return &OCR1B;
+  case PWM_OC1C: return &OCR1C;
+  case PWM_OC3A: return &OCR3A;
+  case PWM_OC3B: return &OCR3B;
+  case PWM_OC3C: return &OCR3C;
+  case PWM_OC4A: return &OCR4A;
+  case PWM_OC4B: return &OCR4B;
+  case PWM_OC4C: return &OCR4C;
+  case PWM_OC5A: return &OCR5A;
+  case PWM_OC5B: return &OCR5B;
+  case PWM_OC5C: return &OCR5C;
+  }
+
+  return 0;
+}
+
+/** Set duty cycle of an output pin (0 .. PWM_TOP). */
+static inline void pwm_set(enum pwm_output oc, uint16_t value)
+{
+  uint8_t i = pwm_index(oc);
+
+  if (i >= PWM_NUM_OUTPUTS)
+    return;
+
+  pwmDuty[i] = value;
+  *pwm_ocr(oc) = ((uint32_t)value * pwmScale) >> 16;
+}
+
+/** Sets the duty cycle of an output (index, see pwm_index, and OCRnx) with
+ * the counts already scaled to the resolution by the caller, e.g., from a
+ * table. The value (0 .. PWM_TOP) is kept to rescale the output when the
+ * frequency changes. */
+static inline void pwm_setScaled(uint8_t i, volatile uint16_t *ocr,
+				 uint16_t value, uint16_t counts)
+{
+  pwmDuty[i] = value;
+  *ocr = counts;
+}
+
+/** Returns current duty cycle of an output pin (0 .. PWM_TOP). */
+static inline uint16_t pwm_get(enum pwm_output oc)
+{
+  uint8_t i = pwm_index(oc);
+
+  if (i >= PWM_NUM_OUTPUTS)
+    return 0;
+
+  return pwmDuty[i];
+}
 
 /** Increases duty cycle of a PWM signal on output pin. */
 void pwm_inc(enum pwm_output oc, uint16_t step);
@@ -28,10 +154,36 @@ void pwm_inc(enum pwm_output oc, uint16_t step);
 /** Decreases duty cycle of a PWM signal on output pin. */
 void pwm_dec(enum pwm_output oc, uint16_t step);
 
-/** Set duty cycle of an output pin, i.e., OCR1x value. */
-void pwm_set(enum pwm_output oc, uint16_t value);
+/** Stages a duty cycle (0 .. PWM_TOP) of an output resolved by the caller
+ * (index, see pwm_index, and OCRnx, see pwm_ocr) for the next commit. The
+ * commit writes the register directly. */
+void pwm_stageOutput(uint8_t i, volatile uint16_t *ocr, uint16_t value);
+
+/** Stages a duty cycle for the next commit (applied by pwm_commit). */
+static inline void pwm_stage(enum pwm_output oc, uint16_t value)
+{
+  uint8_t i = pwm_index(oc);
+
+  if (i < PWM_NUM_OUTPUTS)
+    pwm_stageOutput(i, pwm_ocr(oc), value);
+}
+
+/** Stages pins of a port (pins in mask set to value) for the next commit,
+ * e.g., direction pins of a bridge. Returns -1 if too many ports are
+ * staged. */
+int8_t pwm_stagePins(volatile uint8_t *port, uint8_t mask, uint8_t value);
+
+/** Commits the staged duty cycles and pins. They are applied together at
+ * the next PWM period boundary of all timers. A commit with pins (e.g., a
+ * change of a bridge direction) sets the outputs of the commit to 0 for one
+ * period first and applies pins and duty cycles at the boundary after, so
+ * no output runs with the new duty cycle and the old pins (pins are written
+ * in the ISR, i.e., some cycles after the boundary). A commit not applied
+ * yet is merged with the new one. Returns -1 if pins got lost (too many
+ * ports). */
+int8_t pwm_commit(void);
 
-/** Returns current duty cycle of an output pin, i.e., OCR1x value. */
-uint16_t pwm_get(enum pwm_output oc);
+/** Returns 1 if all commits have been applied. */
+uint8_t pwm_committed(void);
 
 #endif
@@ -4,12 +4,36 @@
  * @date 06.05.2016
  *
  * @brief Header of stepper motor driver.
+ *
+ * Each stepper motor (axis) is an instance (steppermotor_t). Steps are
+ * either taken by the caller (steppermotor_step) or generated by timer 3
+ * with a trapezoidal speed profile. Moves of several axes are linear
+ * segments, i.e., all axes start and finish together. Segments are queued
+ * and run one after another.
+ *
+ * In full and half step mode the coils are switched on port pins, in
+ * microstep mode they are driven by PWM outputs (see pwm.h) with sine and
+ * cosine currents. Positions and speeds are in steps of the mode, e.g., a
+ * full step is 32 steps in MICRO32 mode.
+ *
+ * A motor can be homed against a limit switch or index input (external
+ * interrupt, see extint.h), i.e., position 0 is the edge of the input.
  */
 
 #ifndef __STEPPERMOTOR_H__
 #define __STEPPERMOTOR_H__	
 
 #include <avr/io.h>	// e.g. uint16_t
+#include "pwm.h"
+
+/** Maximum number of stepper motors, i.e., axes of a segment. */
+#define STEPPERMOTOR_MAX_AXES   4
+/** Number of segments in the queue (including the running one). */
+#define STEPPERMOTOR_QUEUE_SIZE 4
+
+/** Limits of the speed of moves (steps/s). */
+#define STEPPERMOTOR_SPEED_MIN  31
+#define STEPPERMOTOR_SPEED_MAX  40000
 
 enum steppermotor_direction {
   RIGHT = 0,
@@ -18,27 +42,113 @@ enum steppermotor_direction {
 
 enum steppermotor_mode {
   HALF = 0,
-  FULL
+  FULL,
+  MICRO8, // 1/8 step
+  MICRO16,
+  MICRO32
 };
 
-/** Initializes pins, position, mode. */
-void steppermotor_init(enum steppermotor_mode mode);
+/** Stepper motor instance (members are private). */
+typedef struct {
+  volatile uint8_t *port; // port of the coils (full, half step)
+  uint8_t mask; // pins of the coils
+  uint8_t patterns[8]; // pins of the steps
+  volatile uint16_t *coils[4]; // OCRnx of the coils (microstep)
+  uint8_t outputs[4]; // PWM outputs of the coils (index, see pwm_index)
+  uint8_t micro;
+  uint8_t microShift; // step to index of the cosine table (shift)
+  uint8_t step; // current step in half/full/micro step mode
+  uint8_t numSteps;
+  uint8_t strideMax; // steps per interrupt, a full step at most (power of 2)
+  volatile int32_t position; // steps taken from the beginning
+  int32_t planned; // position at the end of the queued segments
+  uint8_t homed; // position relative to the home input
+} steppermotor_t;
+
+/** Initializes pins, position, mode (HALF or FULL) of a motor with the
+ * coils A1, A2, B1, B2 (pin numbers) on a port. Returns -1 if there are
+ * too many motors. */
+int8_t steppermotor_init(steppermotor_t *motor, volatile uint8_t *port,
+			 volatile uint8_t *ddr, uint8_t a1, uint8_t a2,
+			 uint8_t b1, uint8_t b2, enum steppermotor_mode mode);
 
-/** 
+/** Initializes a motor in microstep mode (MICRO8 .. MICRO32) with the coils
+ * A1, A2, B1, B2 on PWM outputs. The coil currents follow changes of the
+ * PWM frequency (see pwm_setFrequency). Returns -1 if there are too many
+ * motors. */
+int8_t steppermotor_initMicro(steppermotor_t *motor, enum pwm_output a1,
+			      enum pwm_output a2, enum pwm_output b1,
+			      enum pwm_output b2, enum steppermotor_mode mode);
+
+/**
  * @brief Performs a single step.
  *
  * @param clockwise Direction of rotation (clockwise/right or
- * counter-clockwise/left). 
+ * counter-clockwise/left). Not to be used while moving.
  */
-void steppermotor_step(enum steppermotor_direction dir);
+void steppermotor_step(steppermotor_t *motor, enum steppermotor_direction dir);
 
 /** Start exciting, turn on. */
-void steppermotor_on(void);
+void steppermotor_on(steppermotor_t *motor);
 
 /** Stop exciting, all coils off. */
-void steppermotor_off(void);
+void steppermotor_off(steppermotor_t *motor);
+
+/** Returns current position in steps taken from startup (or from the home
+ * input). */
+int32_t steppermotor_position(steppermotor_t *motor);
+
+/** Reads the positions of several motors at once, i.e., taken at the same
+ * step interrupt. */
+void steppermotor_snapshot(uint8_t num, steppermotor_t * const *motors,
+			   int32_t *positions);
+
+/** Queues a linear move of several axes to the given positions (steps). The
+ * axis with the most steps moves with maximum speed (steps/s) and
+ * acceleration (steps/s^2), the others follow proportionally. Returns at
+ * once, -1 on invalid parameters, a full queue or while stopping. */
+int8_t steppermotor_moveLinear(uint8_t num, steppermotor_t * const *motors,
+			       const int32_t *positions, uint16_t maxSpeed,
+			       uint32_t accel);
+
+/** Queues a move of a single motor to a position (see
+ * steppermotor_moveLinear). */
+int8_t steppermotor_moveTo(steppermotor_t *motor, int32_t position,
+			   uint16_t maxSpeed, uint32_t accel);
+
+/**
+ * @brief Homes a motor against the edge of an external interrupt input.
+ *
+ * Seeks the edge with speed (at most distance steps, the sign gives the
+ * direction), backs off and approaches the edge again with slowSpeed. The
+ * position at the edge is latched in the interrupt and becomes 0. Moves
+ * are rejected while homing, the callback (see steppermotor_setCallback) is
+ * called at the end. Returns -1 on invalid parameters, while moving or if
+ * the external interrupt is used.
+ *
+ * @param no External interrupt INT0 .. INT7 (requested while homing).
+ * @param trigger Edge of the input (see extint.h).
+ */
+int8_t steppermotor_home(steppermotor_t *motor, int8_t no, uint8_t trigger,
+			 int32_t distance, uint16_t speed, uint16_t slowSpeed,
+			 uint32_t accel);
+
+/** Returns 1 if the motor has been homed successfully. */
+uint8_t steppermotor_homed(steppermotor_t *motor);
+
+/** Decelerates and stops the running segment, the queue is cleared (homing
+ * is aborted). */
+void steppermotor_stop(void);
+
+/** Returns 1 while a segment is running. */
+uint8_t steppermotor_moving(void);
+
+/** Returns the number of free entries in the queue. */
+uint8_t steppermotor_queueFree(void);
 
-/** Returns current position in steps taken from startup. */
-int32_t steppermotor_position(void);
+/** Sets a callback called when all queued segments finished (deferred with
+ * the given priority, see dispatch.h, 0 .. none). Returns -1 if the
+ * priority is used already. */
+int8_t steppermotor_setCallback(uint8_t priority, void (*callback)(void));
 
 #endif
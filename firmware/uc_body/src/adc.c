@@ -0,0 +1,282 @@
+/**
+ * @file adc.c
+ * @author Denise Ratasich
+ * @date 17.10.2026
+ *
+ * @brief ADC scanner implementation.
+ *
+ * The ADC runs in free running mode, i.e., the next conversion starts
+ * automatically when the ISR is triggered, still with the previous
+ * multiplexer setting. The ISR therefore selects the channel of the
+ * conversion after the current one: the result belongs to the slot selected
+ * two interrupts ago. The multiplexer is switched at the end of the ISR,
+ * i.e., after processing the value (the selection must not change within
+ * the first ADC clock of a conversion).
+ *
+ * Each slot sums up 4^n results and decimates them to 10+n bits. The
+ * decimated values are put into a ring buffer and filtered by a first order
+ * IIR in Q8 (filtered += (value - filtered) / 2^k).
+ */
+
+#include <avr/interrupt.h>
+#include "adc.h"
+#include "io.h"
+
+/** Scanned channel. */
+typedef struct {
+  uint8_t channel; // ADC0 .. ADC15
+  uint8_t oversampling; // additional bits
+  uint8_t filter; // IIR shift, 0 .. off
+  uint16_t sum; // sum of the conversions of the current value
+  uint8_t count; // conversions of the current value
+  uint16_t last; // last decimated value
+  int32_t filtered; // Q8, -1 .. no value yet
+  uint16_t values[ADC_BUFFER_SIZE];
+  uint8_t head; // next write (free running)
+  uint8_t tail; // next read (free running)
+  uint16_t overruns;
+  uint8_t used;
+} AdcChannelStruct_t;
+
+static volatile AdcChannelStruct_t adcChannels[ADC_MAX_CHANNELS];
+
+/** Slot of the running conversion. */
+static volatile uint8_t adcConverting = 0;
+/** Slot selected for the conversion after the running one. */
+static volatile uint8_t adcNext = 0;
+
+/** Returns the slot scanned after the given one. */
+static uint8_t adc_nextSlot(uint8_t slot)
+{
+  uint8_t i;
+
+  for (i = 0; i < ADC_MAX_CHANNELS; i++) {
+    slot = (slot + 1) % ADC_MAX_CHANNELS;
+    if (adcChannels[slot].used)
+      break;
+  }
+
+  return slot;
+}
+
+/** Selects the input channel (reference AVcc). */
+static inline void adc_select(uint8_t channel)
+{
+  ADMUX = (1 << REFS0) | (channel & 0x07);
+  if (channel & 0x08)
+    ADCSRB |= (1 << MUX5);
+  else
+    ADCSRB &= ~(1 << MUX5);
+}
+
+/** Stops the ADC and restarts the scan with the used slots (interrupts must
+ * be disabled). */
+static void adc_restart(void)
+{
+  uint8_t first;
+
+  ADCSRA = 0; // stop, ADATE cleared, i.e., multiplexer may change
+
+  first = adc_nextSlot(ADC_MAX_CHANNELS - 1);
+  if (!adcChannels[first].used)
+    return; // no channels
+
+  adcConverting = first;
+  adcNext = first;
+  adc_select(adcChannels[first].channel);
+  ADCSRB &= ~((1 << ADTS2) | (1 << ADTS1) | (1 << ADTS0)); // free running
+  ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADATE) | (1 << ADIF)
+    | (1 << ADIE) | ADC_PRESCALER;
+}
+
+void adc_init(void)
+{
+  uint8_t i;
+
+  // mark slots as unused
+  for (i = 0; i < ADC_MAX_CHANNELS; i++)
+    adcChannels[i].used = 0;
+
+  ADCSRA = 0;
+}
+
+int8_t adc_request(uint8_t channel, uint8_t oversampling, uint8_t filter)
+{
+  uint8_t i;
+  uint8_t sreg = SREG;
+
+  if (channel > 15  ||  oversampling > ADC_OVERSAMPLING_MAX
+      ||  filter > ADC_FILTER_MAX)
+    return -1;
+
+  cli();
+  for (i = 0; i < ADC_MAX_CHANNELS; i++)
+    if (!adcChannels[i].used)
+      break;
+  if (i == ADC_MAX_CHANNELS) {
+    SREG = sreg;
+    return -1;
+  }
+
+  adcChannels[i].channel = channel;
+  adcChannels[i].oversampling = oversampling;
+  adcChannels[i].filter = filter;
+  adcChannels[i].sum = 0;
+  adcChannels[i].count = 0;
+  adcChannels[i].last = 0;
+  adcChannels[i].filtered = -1;
+  adcChannels[i].head = 0;
+  adcChannels[i].tail = 0;
+  adcChannels[i].overruns = 0;
+  adcChannels[i].used = 1;
+
+  // pin is input without pullup, digital input buffer disabled
+  if (channel < 8) {
+    ADC_DDR_LOW &= ~(1 << channel);
+    ADC_PORT_LOW &= ~(1 << channel);
+    DIDR0 |= (1 << channel);
+  } else {
+    ADC_DDR_HIGH &= ~(1 << (channel - 8));
+    ADC_PORT_HIGH &= ~(1 << (channel - 8));
+    DIDR2 |= (1 << (channel - 8));
+  }
+
+  adc_restart();
+  SREG = sreg;
+
+  sei();
+
+  return i;
+}
+
+void adc_release(int8_t slot)
+{
+  uint8_t channel;
+  uint8_t sreg = SREG;
+
+  if (slot < 0  ||  slot >= ADC_MAX_CHANNELS)
+    return;
+
+  cli();
+  channel = adcChannels[slot].channel;
+  adcChannels[slot].used = 0;
+  if (channel < 8)
+    DIDR0 &= ~(1 << channel);
+  else
+    DIDR2 &= ~(1 << (channel - 8));
+  adc_restart();
+  SREG = sreg;
+}
+
+uint16_t adc_getLast(int8_t slot)
+{
+  uint16_t value;
+  uint8_t sreg = SREG;
+
+  if (slot < 0  ||  slot >= ADC_MAX_CHANNELS)
+    return 0;
+
+  cli();
+  value = adcChannels[slot].last;
+  SREG = sreg;
+
+  return value;
+}
+
+uint16_t adc_getFiltered(int8_t slot)
+{
+  int32_t filtered;
+  uint8_t sreg = SREG;
+
+  if (slot < 0  ||  slot >= ADC_MAX_CHANNELS)
+    return 0;
+
+  cli();
+  filtered = adcChannels[slot].filtered;
+  SREG = sreg;
+
+  if (filtered < 0)
+    return 0;
+
+  return (filtered + 0x80) >> 8;
+}
+
+uint8_t adc_available(int8_t slot)
+{
+  if (slot < 0  ||  slot >= ADC_MAX_CHANNELS)
+    return 0;
+
+  return (uint8_t)(adcChannels[slot].head - adcChannels[slot].tail);
+}
+
+uint8_t adc_get(int8_t slot, uint16_t *value)
+{
+  uint8_t sreg = SREG;
+  uint8_t ret = 0;
+
+  if (slot < 0  ||  slot >= ADC_MAX_CHANNELS)
+    return 0;
+
+  cli();
+  if (adcChannels[slot].head != adcChannels[slot].tail) {
+    *value = adcChannels[slot].values[adcChannels[slot].tail
+				      % ADC_BUFFER_SIZE];
+    adcChannels[slot].tail++;
+    ret = 1;
+  }
+  SREG = sreg;
+
+  return ret;
+}
+
+uint16_t adc_overruns(int8_t slot)
+{
+  uint16_t overruns;
+  uint8_t sreg = SREG;
+
+  if (slot < 0  ||  slot >= ADC_MAX_CHANNELS)
+    return 0;
+
+  cli();
+  overruns = adcChannels[slot].overruns;
+  SREG = sreg;
+
+  return overruns;
+}
+
+// conversion complete, the next one has already started
+ISR(ADC_vect)
+{
+  uint16_t value = ADC;
+  volatile AdcChannelStruct_t *ch = &adcChannels[adcConverting];
+
+  // pipeline: the running conversion uses the previous selection
+  adcConverting = adcNext;
+  adcNext = adc_nextSlot(adcNext);
+
+  // oversampling and decimation
+  ch->sum += value;
+  if (++ch->count >= (1 << (2 * ch->oversampling))) {
+    value = ch->sum >> ch->oversampling;
+    ch->sum = 0;
+    ch->count = 0;
+    ch->last = value;
+
+    // low-pass
+    if (ch->filter  &&  ch->filtered >= 0)
+      ch->filtered += (((int32_t)value << 8) - ch->filtered) >> ch->filter;
+    else
+      ch->filtered = (int32_t)value << 8;
+
+    // buffer, overwrite the oldest value if full
+    if ((uint8_t)(ch->head - ch->tail) >= ADC_BUFFER_SIZE) {
+      ch->tail++;
+      ch->overruns++;
+    }
+    ch->values[ch->head % ADC_BUFFER_SIZE] = value;
+    ch->head++;
+  }
+
+  // channel of the conversion after the running one
+  adc_select(adcChannels[adcNext].channel);
+}
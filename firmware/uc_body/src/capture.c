@@ -0,0 +1,275 @@
+/**
+ * @file capture.c
+ * @author Denise Ratasich
+ * @date 17.10.2026
+ *
+ * @brief Input capture implementation.
+ *
+ * Timer 4 and 5 run in normal mode with prescaler 8. The capture ISR stores
+ * the latched time (ICRn) and the overflow count into a ring buffer, which
+ * keeps the last CAPTURE_BUFFER_SIZE edges for the period calculation. A
+ * capture shortly after an overflow may be serviced before the overflow
+ * ISR, in this case the pending overflow is added to the time.
+ */
+
+#include <avr/interrupt.h>
+#include "capture.h"
+#include "io.h"
+
+/** Input capture unit, collects edge times. */
+typedef struct {
+  uint32_t times[CAPTURE_BUFFER_SIZE];
+  uint8_t head; // next write (free running)
+  uint8_t tail; // next read (free running)
+  uint8_t edges; // edges in the buffer for the period (max. buffer size)
+  uint16_t overflows; // upper 16 bits of the time
+  uint16_t overruns;
+  uint8_t pulsesPerRev;
+  uint8_t used;
+} CaptureStruct_t;
+
+static volatile CaptureStruct_t captures[CAPTURE_UNIT_NUM];
+
+void capture_init(void)
+{
+  uint8_t i;
+
+  // mark units as unused
+  for (i = 0; i < CAPTURE_UNIT_NUM; i++)
+    captures[i].used = 0;
+}
+
+int8_t capture_request(uint8_t unit, uint8_t edge, uint8_t pulsesPerRev)
+{
+  uint8_t sreg = SREG;
+  // noise canceler, edge select, prescaler = 8 (0.5us per count)
+  uint8_t tccrb = (1 << ICNC4) | ((edge & 0x01) << ICES4) | (2 << CS40);
+
+  // valid unit and unused?
+  if (unit >= CAPTURE_UNIT_NUM  ||  captures[unit].used)
+    return -1;
+  if (pulsesPerRev == 0)
+    return -1;
+  // timer used for PWM (WGMn3 is set in all PWM modes of pwm.c)
+  if ((unit == CAPTURE_UNIT_ICP4  &&  (TCCR4B & (1 << WGM43)))
+      ||  (unit == CAPTURE_UNIT_ICP5  &&  (TCCR5B & (1 << WGM53))))
+    return -1;
+
+  cli();
+  captures[unit].head = 0;
+  captures[unit].tail = 0;
+  captures[unit].edges = 0;
+  captures[unit].overflows = 0;
+  captures[unit].overruns = 0;
+  captures[unit].pulsesPerRev = pulsesPerRev;
+  captures[unit].used = 1;
+
+  switch (unit) {
+  case CAPTURE_UNIT_ICP4:
+    CAPTURE_DDR &= ~(1 << CAPTURE_ICP4); // pin is input
+    CAPTURE_PORT |= (1 << CAPTURE_ICP4); // activate pullup
+    // Timer 4 in normal mode
+    TCCR4A = 0x00;
+    TCCR4B = tccrb;
+    TCNT4 = 0;
+    TIFR4 = (1 << ICF4) | (1 << TOV4); // clear pending interrupts
+    TIMSK4 |= (1 << ICIE4) | (1 << TOIE4);
+    break;
+  case CAPTURE_UNIT_ICP5:
+    CAPTURE_DDR &= ~(1 << CAPTURE_ICP5);
+    CAPTURE_PORT |= (1 << CAPTURE_ICP5);
+    // Timer 5 in normal mode
+    TCCR5A = 0x00;
+    TCCR5B = tccrb; // bits of TCCR4B and TCCR5B are equal
+    TCNT5 = 0;
+    TIFR5 = (1 << ICF5) | (1 << TOV5);
+    TIMSK5 |= (1 << ICIE5) | (1 << TOIE5);
+    break;
+  }
+  SREG = sreg;
+
+  sei();
+
+  return unit;
+}
+
+void capture_release(uint8_t unit)
+{
+  if (unit >= CAPTURE_UNIT_NUM)
+    return;
+
+  switch (unit) {
+  case CAPTURE_UNIT_ICP4:
+    TIMSK4 &= ~((1 << ICIE4) | (1 << TOIE4));
+    TCCR4B = 0x00; // timer stopped
+    break;
+  case CAPTURE_UNIT_ICP5:
+    TIMSK5 &= ~((1 << ICIE5) | (1 << TOIE5));
+    TCCR5B = 0x00;
+    break;
+  }
+  captures[unit].used = 0;
+}
+
+/** Extends a 16-bit counter value to 32 bit (interrupts must be
+ * disabled). */
+static inline uint32_t capture_extend(uint8_t unit, uint16_t count,
+				      uint8_t overflowPending)
+{
+  uint16_t overflows = captures[unit].overflows;
+
+  // overflow not yet counted by the ISR and happened before count was
+  // latched (count is small)
+  if (overflowPending  &&  count < 0x8000)
+    overflows++;
+
+  return ((uint32_t)overflows << 16) | count;
+}
+
+uint32_t capture_getTime(uint8_t unit)
+{
+  uint32_t now = 0;
+  uint8_t sreg = SREG;
+
+  cli();
+  switch (unit) {
+  case CAPTURE_UNIT_ICP4:
+    now = capture_extend(unit, TCNT4, TIFR4 & (1 << TOV4));
+    break;
+  case CAPTURE_UNIT_ICP5:
+    now = capture_extend(unit, TCNT5, TIFR5 & (1 << TOV5));
+    break;
+  }
+  SREG = sreg;
+
+  return now;
+}
+
+uint8_t capture_available(uint8_t unit)
+{
+  if (unit >= CAPTURE_UNIT_NUM)
+    return 0;
+
+  return (uint8_t)(captures[unit].head - captures[unit].tail);
+}
+
+uint8_t capture_get(uint8_t unit, uint32_t *time)
+{
+  uint8_t sreg = SREG;
+  uint8_t ret = 0;
+
+  if (unit >= CAPTURE_UNIT_NUM)
+    return 0;
+
+  cli();
+  if (captures[unit].head != captures[unit].tail) {
+    *time = captures[unit].times[captures[unit].tail % CAPTURE_BUFFER_SIZE];
+    captures[unit].tail++;
+    ret = 1;
+  }
+  SREG = sreg;
+
+  return ret;
+}
+
+uint16_t capture_overruns(uint8_t unit)
+{
+  uint16_t overruns;
+  uint8_t sreg = SREG;
+
+  if (unit >= CAPTURE_UNIT_NUM)
+    return 0;
+
+  cli();
+  overruns = captures[unit].overruns;
+  SREG = sreg;
+
+  return overruns;
+}
+
+uint32_t capture_getPeriod(uint8_t unit)
+{
+  uint32_t newest, oldest;
+  uint8_t edges, head;
+  uint8_t sreg = SREG;
+
+  if (unit >= CAPTURE_UNIT_NUM)
+    return 0;
+
+  cli();
+  edges = captures[unit].edges;
+  head = captures[unit].head;
+  newest = captures[unit].times[(uint8_t)(head - 1) % CAPTURE_BUFFER_SIZE];
+  oldest = captures[unit].times[(uint8_t)(head - edges) % CAPTURE_BUFFER_SIZE];
+  SREG = sreg;
+
+  if (edges < 2)
+    return 0;
+  if (capture_getTime(unit) - newest > CAPTURE_TIMEOUT)
+    return 0; // stopped
+
+  return (newest - oldest) / (edges - 1);
+}
+
+uint32_t capture_getFrequency(uint8_t unit)
+{
+  uint32_t period = capture_getPeriod(unit);
+
+  if (period == 0)
+    return 0;
+
+  return (CAPTURE_COUNTS_PER_S * 1000UL) / period;
+}
+
+uint32_t capture_getRpm(uint8_t unit)
+{
+  uint32_t period = capture_getPeriod(unit);
+
+  if (period == 0)
+    return 0;
+
+  return (CAPTURE_COUNTS_PER_S * 60UL)
+    / (period * captures[unit].pulsesPerRev);
+}
+
+/** Stores the time of an edge (called by the capture ISRs). */
+static inline void capture_store(uint8_t unit, uint32_t time)
+{
+  volatile CaptureStruct_t *c = &captures[unit];
+
+  c->times[c->head % CAPTURE_BUFFER_SIZE] = time;
+  c->head++;
+
+  if ((uint8_t)(c->head - c->tail) > CAPTURE_BUFFER_SIZE) {
+    c->tail++; // oldest edge overwritten
+    c->overruns++;
+  }
+  if (c->edges < CAPTURE_BUFFER_SIZE)
+    c->edges++;
+}
+
+//
+// interrupt service routines
+//
+
+ISR(TIMER4_CAPT_vect)
+{
+  capture_store(CAPTURE_UNIT_ICP4,
+		capture_extend(CAPTURE_UNIT_ICP4, ICR4, TIFR4 & (1 << TOV4)));
+}
+
+ISR(TIMER4_OVF_vect)
+{
+  captures[CAPTURE_UNIT_ICP4].overflows++;
+}
+
+ISR(TIMER5_CAPT_vect)
+{
+  capture_store(CAPTURE_UNIT_ICP5,
+		capture_extend(CAPTURE_UNIT_ICP5, ICR5, TIFR5 & (1 << TOV5)));
+}
+
+ISR(TIMER5_OVF_vect)
+{
+  captures[CAPTURE_UNIT_ICP5].overflows++;
+}
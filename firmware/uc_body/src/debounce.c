@@ -0,0 +1,197 @@
+/**
+ * @file debounce.c
+ * @author Denise Ratasich
+ * @date 17.10.2026
+ *
+ * @brief Debounce module implementation.
+ *
+ * All inputs share a single one-shot GPT which expires at the earliest
+ * deadline of the settling inputs.
+ */
+
+#include <avr/interrupt.h>
+#include "debounce.h"
+#include "extint.h"
+#include "gpt.h"
+#include "dispatch.h"
+
+/** Debounced input, collects information to debounce requests. */
+typedef struct {
+  uint32_t deadline; // end of the settle time (ms, see gpt_getTime)
+  uint16_t settleTime; // in ms
+  uint8_t trigger;
+  uint8_t level; // last confirmed level
+  int8_t event; // deferred callback event
+} DebounceStruct_t;
+
+/** Debounced inputs. */
+static DebounceStruct_t debounces[DEBOUNCE_NUM];
+
+/** Inputs in use (bit i .. INTi). */
+static uint8_t debounceUsed = 0;
+/** Inputs waiting for the settle time to elapse (bit i .. INTi). */
+static volatile uint8_t debounceSettling = 0;
+
+/** Timer checking the settling inputs (-1 .. not running). */
+static volatile int8_t debounceTimer = -1;
+/** Expiry of the timer (ms). */
+static uint32_t debounceNext;
+
+static void debounce_check(void);
+
+/** Starts the timer for a deadline, unless it expires earlier anyway
+ * (interrupts must be disabled). */
+static void debounce_schedule(uint32_t deadline)
+{
+  if (debounceTimer >= 0) {
+    if ((int32_t)(deadline - debounceNext) >= 0)
+      return;
+    gpt_releaseTimer(debounceTimer);
+  }
+
+  debounceTimer = gpt_requestAt(deadline, debounce_check);
+  debounceNext = deadline;
+}
+
+/** Called on the first edge, masks the interrupt until the input settled. */
+static void debounce_edge(uint8_t no)
+{
+  extint_disable(no);
+
+  debounces[no].deadline = gpt_getTime() + debounces[no].settleTime;
+  debounceSettling |= (1 << no);
+  debounce_schedule(debounces[no].deadline);
+
+  if (debounceTimer < 0) {
+    // no timer available, ignore this edge
+    debounceSettling &= ~(1 << no);
+    extint_enable(no);
+  }
+}
+
+// callbacks of the external interrupts (without parameter)
+static void debounce_edge0(void) { debounce_edge(0); }
+static void debounce_edge1(void) { debounce_edge(1); }
+static void debounce_edge2(void) { debounce_edge(2); }
+static void debounce_edge3(void) { debounce_edge(3); }
+static void debounce_edge4(void) { debounce_edge(4); }
+static void debounce_edge5(void) { debounce_edge(5); }
+static void debounce_edge6(void) { debounce_edge(6); }
+static void debounce_edge7(void) { debounce_edge(7); }
+
+static void (* const debounceEdges[DEBOUNCE_NUM])(void) = {
+  debounce_edge0, debounce_edge1, debounce_edge2, debounce_edge3,
+  debounce_edge4, debounce_edge5, debounce_edge6, debounce_edge7
+};
+
+/** Confirms the level of the settled inputs (called by the GPT). */
+static void debounce_check(void)
+{
+  uint8_t no, level, confirmed;
+  uint32_t now = gpt_getTime();
+  uint32_t next = 0;
+  uint8_t waiting = 0;
+
+  // one-shot timer expired, release it (the id is not valid afterwards)
+  gpt_releaseTimer(debounceTimer);
+  debounceTimer = -1;
+
+  for (no = 0; no < DEBOUNCE_NUM; no++) {
+    if (!(debounceSettling & (1 << no)))
+      continue;
+
+    if ((int32_t)(now - debounces[no].deadline) < 0) {
+      // still settling
+      if (!waiting  ||  (int32_t)(debounces[no].deadline - next) < 0)
+	next = debounces[no].deadline;
+      waiting = 1;
+      continue;
+    }
+
+    level = extint_getLevel(no);
+    switch (debounces[no].trigger) {
+    case EXTINT_TRIGGER_FALLING_EDGE:
+      confirmed = (level == 0);
+      break;
+    case EXTINT_TRIGGER_RISING_EDGE:
+      confirmed = (level == 1);
+      break;
+    default:
+      confirmed = (level != debounces[no].level);
+      break;
+    }
+    debounces[no].level = level;
+
+    if (confirmed)
+      dispatch_post(debounces[no].event); // call in main loop
+
+    debounceSettling &= ~(1 << no);
+    extint_enable(no);
+  }
+
+  if (waiting)
+    debounce_schedule(next);
+}
+
+void debounce_init(void)
+{
+  debounceUsed = 0;
+  debounceSettling = 0;
+  debounceTimer = -1;
+}
+
+int8_t debounce_request(int8_t no, uint8_t trigger, uint16_t settleTime,
+			uint8_t priority, void (*callback)(void))
+{
+  int8_t event;
+
+  // valid no and unused?
+  if (no < 0  ||  no >= DEBOUNCE_NUM  ||  (debounceUsed & (1 << no)))
+    return -1;
+  // valid trigger? (level trigger cannot be debounced)
+  if (trigger == EXTINT_TRIGGER_LOW_LEVEL  ||  trigger > 3)
+    return -1;
+
+  event = dispatch_request(priority, callback);
+  if (event < 0)
+    return -1;
+
+  debounces[no].settleTime = settleTime;
+  debounces[no].trigger = trigger;
+  debounces[no].event = event;
+
+  if (extint_requestInt(no, trigger, debounceEdges[no]) < 0) {
+    dispatch_release(event);
+    return -1;
+  }
+  debounces[no].level = extint_getLevel(no); // after pullup is activated
+  debounceUsed |= (1 << no);
+
+  return no;
+}
+
+void debounce_release(int8_t no)
+{
+  uint8_t sreg = SREG;
+
+  // valid no and used?
+  if (no < 0  ||  no >= DEBOUNCE_NUM  ||  !(debounceUsed & (1 << no)))
+    return;
+
+  cli();
+  extint_releaseInt(no);
+  debounceSettling &= ~(1 << no);
+  SREG = sreg;
+
+  dispatch_release(debounces[no].event);
+  debounceUsed &= ~(1 << no);
+}
+
+uint8_t debounce_getLevel(int8_t no)
+{
+  // valid no?
+  if (no < 0  ||  no >= DEBOUNCE_NUM)
+    return 0;
+
+  return debounces[no].level;
+}
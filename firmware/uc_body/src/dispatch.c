@@ -0,0 +1,94 @@
+/**
+ * @file dispatch.c
+ * @author Denise Ratasich
+ * @date 17.10.2026
+ *
+ * @brief Deferred callback dispatcher implementation.
+ *
+ * Each event has a pending flag (one byte, so it is written atomically by
+ * the ISR and no locking is needed). dispatch() clears the flag and runs the
+ * callback. After each callback the search starts again at the highest
+ * priority.
+ */
+
+#include "dispatch.h"
+
+/** Event element, collects information to event requests. */
+typedef struct {
+  void (*callback)(void);
+  volatile uint8_t pending;
+  uint8_t used;
+} DispatchStruct_t;
+
+/** Event elements (index = priority). */
+static DispatchStruct_t events[DISPATCH_MAX_EVENTS];
+
+/** Set when any event has been posted. */
+static volatile uint8_t anyPending = 0;
+
+void dispatch_init(void)
+{
+  uint8_t i;
+
+  // mark event elements as unused
+  for (i = 0; i < DISPATCH_MAX_EVENTS; i++) {
+    events[i].used = 0;
+    events[i].pending = 0;
+  }
+}
+
+int8_t dispatch_request(uint8_t priority, void (*callback)(void))
+{
+  if (priority >= DISPATCH_MAX_EVENTS)
+    return -1;
+
+  // check if event is unused
+  if (events[priority].used)
+    return -1;
+
+  events[priority].callback = callback;
+  events[priority].pending = 0;
+  events[priority].used = 1;
+
+  return priority;
+}
+
+void dispatch_release(int8_t event)
+{
+  if (event < 0  ||  event >= DISPATCH_MAX_EVENTS)
+    return;
+
+  events[event].used = 0;
+  events[event].pending = 0;
+}
+
+void dispatch_post(int8_t event)
+{
+  events[event].pending = 1;
+  anyPending = 1;
+}
+
+uint8_t dispatch_pending(void)
+{
+  return anyPending;
+}
+
+void dispatch(void)
+{
+  uint8_t i;
+
+  while (anyPending) {
+    anyPending = 0;
+
+    // run the pending event with highest priority
+    for (i = 0; i < DISPATCH_MAX_EVENTS; i++) {
+      if (events[i].pending) {
+	events[i].pending = 0;
+	if (events[i].used)
+	  (*(events[i].callback))(); // call callback-function
+	anyPending = 1; // search again from highest priority
+	break;
+      }
+    }
+  }
+}
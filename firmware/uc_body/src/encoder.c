@@ -0,0 +1,237 @@
+/**
+ * @file encoder.c
+ * @author Denise Ratasich
+ * @date 17.10.2026
+ *
+ * @brief Quadrature encoder implementation.
+ *
+ * Channel A and B are on the same port and share the pin change interrupt,
+ * so the ISR reads both at once and looks up the step in a table indexed by
+ * the previous and current state.
+ *
+ * At high speed (at least ENCODER_COUNT_FAST counts per sample time) the
+ * velocity is the change of the position over the sample time. Below
+ * ENCODER_COUNT_SLOW the ISR additionally stores the time of the last edge
+ * and the velocity is the change of the position between the last edges of
+ * two samples over the time between these edges. The timestamps are not
+ * taken at high speed, to keep the ISR short.
+ */
+
+#include <avr/interrupt.h>
+#include "encoder.h"
+#include "gpt.h"
+#include "io.h"
+
+/** Counts per sample time to switch to count-based estimation. */
+#define ENCODER_COUNT_FAST      16
+/** Counts per sample time to switch to period-based estimation. */
+#define ENCODER_COUNT_SLOW      8
+/** Time without edges until the velocity is zero (us). */
+#define ENCODER_STOP_TIME       500000UL
+
+/** Position change per transition, index is (previous state << 2) | state
+ * with state = (B << 1) | A. */
+static const int8_t encoderSteps[16] = {
+  0, 1, -1, 0,
+  -1, 0, 0, 1,
+  1, 0, 0, -1,
+  0, -1, 1, 0
+};
+
+/** Transitions changing both channels (missed edge). */
+#define ENCODER_INVALID(index)  (((((index) >> 2) ^ (index)) & 0x03) == 0x03)
+
+static volatile int32_t encoderPosition = 0;
+static volatile uint8_t encoderState;
+static volatile uint16_t encoderErrors = 0;
+
+/** 1 .. ISR stores the time of the last edge (period-based estimation). */
+static volatile uint8_t encoderStamp = 1;
+/** Time (us) and position of the last edge, set by the ISR. */
+static volatile uint32_t encoderEdgeTime;
+static volatile int32_t encoderEdgePosition;
+
+/** Position at the last sample (count-based estimation). */
+static int32_t encoderSamplePosition;
+/** Time of the last sample (us). */
+static uint32_t encoderSampleTime;
+/** Time (us) and position of the last edge used for an estimate. */
+static uint32_t encoderRefTime;
+static int32_t encoderRefPosition;
+
+static volatile int32_t encoderVelocity = 0;
+
+/** Returns counts per dt (us) in counts/s. */
+static int32_t encoder_rate(int32_t counts, uint32_t dt)
+{
+  // counts * 10^6 must not overflow
+  if (counts < 2000  &&  counts > -2000)
+    return (counts * 1000000L) / (int32_t)dt;
+  else
+    return (counts * 100000L) / (int32_t)(dt / 10);
+}
+
+/** Estimates the velocity (deferred, every ENCODER_SAMPLE_TIME ms). */
+static void encoder_sample(void)
+{
+  int32_t position, edgePosition, counts, velocity;
+  uint32_t now, edgeTime, dt;
+  uint8_t stamp;
+  uint8_t sreg = SREG;
+
+  cli();
+  position = encoderPosition;
+  edgePosition = encoderEdgePosition;
+  edgeTime = encoderEdgeTime;
+  stamp = encoderStamp;
+  now = gpt_getTimeUs();
+  SREG = sreg;
+
+  counts = position - encoderSamplePosition;
+  dt = now - encoderSampleTime;
+  if (dt == 0)
+    return; // called twice within a GPT count, keep last estimate
+
+  if (!stamp) {
+    // count-based
+    velocity = encoder_rate(counts, dt);
+    if (counts < ENCODER_COUNT_SLOW  &&  counts > -ENCODER_COUNT_SLOW) {
+      // slow, start taking timestamps
+      encoderRefTime = now;
+      encoderRefPosition = position;
+      encoderEdgeTime = now;
+      encoderEdgePosition = position;
+      encoderStamp = 1;
+    }
+  } else if (edgeTime != encoderRefTime) {
+    // period-based, position change between two edges
+    velocity = encoder_rate(edgePosition - encoderRefPosition,
+			    edgeTime - encoderRefTime);
+    encoderRefTime = edgeTime;
+    encoderRefPosition = edgePosition;
+  } else {
+    // no edge since the last estimate, the velocity is at most one count
+    // over the time since the last edge
+    velocity = encoderVelocity;
+    dt = now - encoderRefTime;
+    if (dt >= ENCODER_STOP_TIME)
+      velocity = 0;
+    else if (velocity > (int32_t)(1000000UL / dt))
+      velocity = 1000000UL / dt;
+    else if (velocity < -(int32_t)(1000000UL / dt))
+      velocity = -(int32_t)(1000000UL / dt);
+  }
+
+  if (stamp
+      && (counts >= ENCODER_COUNT_FAST  ||  counts <= -ENCODER_COUNT_FAST))
+    encoderStamp = 0; // fast, count-based from now on
+
+  encoderSamplePosition = position;
+  encoderSampleTime = now;
+  encoderVelocity = velocity;
+}
+
+void encoder_init(void)
+{
+  uint8_t sreg = SREG;
+
+  // inputs with pullup
+  ENCODER_DDR &= ~((1 << ENCODER_A) | (1 << ENCODER_B));
+  ENCODER_PORT |= (1 << ENCODER_A) | (1 << ENCODER_B);
+
+  cli();
+  encoderState = ((ENCODER_PIN >> ENCODER_A) & 0x01)
+    | (((ENCODER_PIN >> ENCODER_B) & 0x01) << 1);
+  encoderPosition = 0;
+  encoderSampleTime = gpt_getTimeUs();
+  encoderRefTime = encoderSampleTime;
+  encoderEdgeTime = encoderSampleTime;
+  encoderSamplePosition = 0;
+  encoderRefPosition = 0;
+  encoderEdgePosition = 0;
+  encoderStamp = 1;
+  encoderVelocity = 0;
+
+  // pin change interrupt on channel A and B
+  PCMSK2 |= (1 << ENCODER_A) | (1 << ENCODER_B); // PCINT16, PCINT17
+  PCIFR = (1 << PCIF2); // clear pending interrupt
+  PCICR |= (1 << PCIE2);
+  SREG = sreg;
+
+  gpt_requestTimerDeferred(ENCODER_SAMPLE_TIME, ENCODER_PRIORITY,
+			   encoder_sample);
+
+  sei();
+}
+
+int32_t encoder_getPosition(void)
+{
+  int32_t position;
+  uint8_t sreg = SREG;
+
+  // 32-bit read is not atomic
+  cli();
+  position = encoderPosition;
+  SREG = sreg;
+
+  return position;
+}
+
+void encoder_setPosition(int32_t position)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  encoderSamplePosition += position - encoderPosition;
+  encoderRefPosition += position - encoderPosition;
+  encoderEdgePosition += position - encoderPosition;
+  encoderPosition = position;
+  SREG = sreg;
+}
+
+int32_t encoder_getVelocity(void)
+{
+  int32_t velocity;
+  uint8_t sreg = SREG;
+
+  cli();
+  velocity = encoderVelocity;
+  SREG = sreg;
+
+  return velocity;
+}
+
+uint16_t encoder_errors(void)
+{
+  uint16_t errors;
+  uint8_t sreg = SREG;
+
+  cli();
+  errors = encoderErrors;
+  SREG = sreg;
+
+  return errors;
+}
+
+//
+// pin change interrupt (channel A or B changed)
+//
+
+ISR(PCINT2_vect)
+{
+  uint8_t pins = ENCODER_PIN;
+  uint8_t state = ((pins >> ENCODER_A) & 0x01)
+    | (((pins >> ENCODER_B) & 0x01) << 1);
+  uint8_t index = (encoderState << 2) | state;
+
+  encoderState = state;
+  encoderPosition += encoderSteps[index];
+
+  if (ENCODER_INVALID(index))
+    encoderErrors++;
+
+  if (encoderStamp) {
+    encoderEdgeTime = gpt_getTimeUs();
+    encoderEdgePosition = encoderPosition;
+  }
+}
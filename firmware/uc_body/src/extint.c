@@ -8,6 +8,7 @@
 
 #include <avr/interrupt.h>
 #include "extint.h"
+#include "dispatch.h"
 #include "io.h" // port, pins definition
 
 /** Number of external interrupts. */
@@ -17,6 +18,7 @@
 typedef struct {
   void (*callback)(void);
   uint8_t used;
+  int8_t event; // deferred callback event (-1 .. callback called in ISR)
 } ExtintStruct_t;
 
 /** External interrupt elements. */
@@ -31,7 +33,10 @@ void extint_init()
     extints[i].used = 0;
 }
 
-int8_t extint_requestInt(int8_t no, uint8_t trigger, void (*callback)(void))
+/** Request an external interrupt with deferred (event >= 0) or immediate
+ * callback. */
+static int8_t extint_request(int8_t no, uint8_t trigger,
+			     void (*callback)(void), int8_t event)
 {
   // valid no?
   if (no < 0  ||  no > 7)
@@ -47,6 +52,7 @@ int8_t extint_requestInt(int8_t no, uint8_t trigger, void (*callback)(void))
   // set corresponding external interrupt element
   extints[no].used = 1;
   extints[no].callback = callback;
+  extints[no].event = event;
 
   // pin and interrupt settings
   switch (no) {
@@ -72,7 +78,7 @@ int8_t extint_requestInt(int8_t no, uint8_t trigger, void (*callback)(void))
     return -1; // should never reach this line
   }
 
-  EIFR &= ~(1 << no); // clear pending interrupts on this pin first
+  EIFR = (1 << no); // clear pending interrupts on this pin first
   EIMSK |= (1 << no); // enable interrupt
 
   sei();
@@ -80,6 +86,31 @@ int8_t extint_requestInt(int8_t no, uint8_t trigger, void (*callback)(void))
   return no;
 }
 
+int8_t extint_requestInt(int8_t no, uint8_t trigger, void (*callback)(void))
+{
+  return extint_request(no, trigger, callback, -1);
+}
+
+int8_t extint_requestIntDeferred(int8_t no, uint8_t trigger, uint8_t priority,
+				 void (*callback)(void))
+{
+  int8_t event, ret;
+
+  // valid no and unused?
+  if (no < 0  ||  no > 7  ||  extints[no].used)
+    return -1;
+
+  event = dispatch_request(priority, callback);
+  if (event < 0)
+    return -1;
+
+  ret = extint_request(no, trigger, callback, event);
+  if (ret < 0)
+    dispatch_release(event);
+
+  return ret;
+}
+
 void extint_releaseInt(int8_t no)
 {
   // valid no?
@@ -88,58 +119,98 @@ void extint_releaseInt(int8_t no)
 
   // deactivate external interrupt
   EIMSK &= ~(1 << no); // disable interrupt
-  EIFR &= ~(1 << no); // clear pending flags
+  EIFR = (1 << no); // clear pending flags
+  if (extints[no].used)
+    dispatch_release(extints[no].event);
   extints[no].used = 0; // mark as unused
 }
 
+void extint_disable(int8_t no)
+{
+  // valid no?
+  if (no < 0  ||  no > 7)
+    return;
+
+  EIMSK &= ~(1 << no);
+}
+
+void extint_enable(int8_t no)
+{
+  uint8_t sreg = SREG;
+
+  // valid no and used?
+  if (no < 0  ||  no > 7  ||  !extints[no].used)
+    return;
+
+  cli();
+  EIFR = (1 << no); // flag is cleared by writing a one
+  EIMSK |= (1 << no);
+  SREG = sreg;
+}
+
+uint8_t extint_getLevel(int8_t no)
+{
+  // valid no?
+  if (no < 0  ||  no > 7)
+    return 0;
+
+  if (no < 4)
+    return (EXTINTA_PIN >> no) & 0x01;
+  else
+    return (EXTINTB_PIN >> no) & 0x01;
+}
+
+/** Calls or defers the callback of an external interrupt. */
+static inline void extint_handle(uint8_t no)
+{
+  if (extints[no].used) {
+    if (extints[no].event >= 0)
+      dispatch_post(extints[no].event); // call in main loop
+    else
+      (*(extints[no].callback))(); // call callback-function
+  }
+}
+
 //
 // external interrupt service routines
 //
 
 ISR(INT0_vect)
 {
-  if (extints[0].used)
-    (*(extints[0].callback))(); // call callback-function
+  extint_handle(0);
 }
 
 ISR(INT1_vect)
 {
-  if (extints[1].used)
-    (*(extints[1].callback))(); // call callback-function
+  extint_handle(1);
 }
 
 ISR(INT2_vect)
 {
-  if (extints[2].used)
-    (*(extints[2].callback))(); // call callback-function
+  extint_handle(2);
 }
 
 ISR(INT3_vect)
 {
-  if (extints[3].used)
-    (*(extints[3].callback))(); // call callback-function
+  extint_handle(3);
 }
 
 ISR(INT4_vect)
 {
-  if (extints[4].used)
-    (*(extints[4].callback))(); // call callback-function
+  extint_handle(4);
 }
 
 ISR(INT5_vect)
 {
-  if (extints[5].used)
-    (*(extints[5].callback))(); // call callback-function
+  extint_handle(5);
 }
 
 ISR(INT6_vect)
 {
-  if (extints[6].used)
-    (*(extints[6].callback))(); // call callback-function
+  extint_handle(6);
 }
 
 ISR(INT7_vect)
 {
-  if (extints[7].used)
-    (*(extints[7].callback))(); // call callback-function
+  extint_handle(7);
 }
@@ -6,33 +6,219 @@
  * @brief General purpose timer implementation (1ms resolution).
  *
  * Timer 2 (8-bit timer) used as general purpose timer (GPT). Timer resolution
- * is 1ms. Maximum overflow time is 65535ms.
+ * is 1ms. Maximum overflow time is 2^32-1 ms (about 49 days).
+ *
+ * Running timers are kept in a list sorted by expiry. Each element stores the
+ * number of ticks after its predecessor expires (delta), so the ISR only
+ * decrements the head and touches the timers which actually expire.
+ *
+ * In tickless mode (GPT_TICKLESS) Timer 2 runs freely with prescaler 1024 and
+ * the compare match is set to the next deadline (or at most GPT_MAX_COUNTS
+ * ahead). Elapsed counts are accumulated in units of 4us and converted to ms
+ * whenever the interrupt fires or the time is read.
  */
 
 #include <avr/interrupt.h>
 #include "gpt.h"
+#include "dispatch.h"
 
-static uint32_t gptTime = 0;
+/** Maximum counts between two compare interrupts in tickless mode. */
+#define GPT_MAX_COUNTS          250
+/** Length of a tick (1ms) in units of 4us. */
+#define GPT_TICK_UNITS          250
+/** Length of a timer count (64us) in units of 4us (as power of 2). */
+#define GPT_COUNT_SHIFT         4
+
+static volatile uint32_t gptTime = 0;
 
 /** Current number of timers in use. */
 static uint8_t gptNrTimers = 0;
 
 /** Timer element, collects information to timer requests. */
-static GPTimerStruct_t gptTimerField[GPT_MAX_TIMERS];
+static volatile GPTimerStruct_t gptTimerField[GPT_MAX_TIMERS];
+
+/** Timer expiring next (-1 .. no timer running). */
+static volatile int8_t gptHead = -1;
+
+/** Ticks elapsed but not yet applied to the expiry list. */
+static uint16_t gptPending = 0;
+
+#if GPT_TICKLESS
+/** Counter value up to which the time has been accounted. */
+static uint8_t gptLastCount = 0;
+/** Accounted time not yet making up a full tick (in units of 4us). */
+static uint16_t gptSubTicks = 0;
+#endif
+
+/** Inserts a timer into the expiry list (interrupts must be disabled). */
+static void gpt_insert(int8_t timerId, uint32_t ticks)
+{
+  int8_t prev = -1;
+  int8_t cur = gptHead;
+
+  // skip timers expiring earlier or at the same time (keep FIFO order)
+  while (cur >= 0 && gptTimerField[cur].delta <= ticks) {
+    ticks -= gptTimerField[cur].delta;
+    prev = cur;
+    cur = gptTimerField[cur].next;
+  }
+
+  gptTimerField[timerId].delta = ticks;
+  gptTimerField[timerId].next = cur;
+  gptTimerField[timerId].queued = 1;
+  if (cur >= 0)
+    gptTimerField[cur].delta -= ticks;
+
+  if (prev < 0)
+    gptHead = timerId;
+  else
+    gptTimerField[prev].next = timerId;
+}
+
+/** Removes a timer from the expiry list (interrupts must be disabled). */
+static void gpt_unlink(int8_t timerId)
+{
+  int8_t prev = -1;
+  int8_t cur = gptHead;
+
+  if (!gptTimerField[timerId].queued)
+    return;
+
+  while (cur >= 0 && cur != timerId) {
+    prev = cur;
+    cur = gptTimerField[cur].next;
+  }
+  if (cur < 0)
+    return; // should never happen
+
+  // pass remaining time to successor
+  cur = gptTimerField[timerId].next;
+  if (cur >= 0)
+    gptTimerField[cur].delta += gptTimerField[timerId].delta;
+
+  if (prev < 0)
+    gptHead = cur;
+  else
+    gptTimerField[prev].next = cur;
+  gptTimerField[timerId].queued = 0;
+}
+
+/** Removes expired timers from the list, re-arms and calls them. */
+static void gpt_expire(void)
+{
+  int8_t i;
+
+  while (gptHead >= 0)
+  {
+    if (gptTimerField[gptHead].delta > gptPending) {
+      gptTimerField[gptHead].delta -= gptPending;
+      break;
+    }
+
+    // time elapsed
+    i = gptHead;
+    gptPending -= gptTimerField[i].delta;
+    gptHead = gptTimerField[i].next;
+    gptTimerField[i].queued = 0;
+
+    // re-arm before the callback, so the callback may change or release
+    // its own timer (a one-shot keeps its slot until released by the
+    // owner)
+    if (!gptTimerField[i].oneShot)
+      gpt_insert(i, gptTimerField[i].overflowTime);
+    if (gptTimerField[i].event >= 0)
+      dispatch_post(gptTimerField[i].event); // call in main loop
+    else
+      (*(gptTimerField[i].callback))(); // call callback-function
+  }
+
+  gptPending = 0;
+}
+
+#if GPT_TICKLESS
+/** Converts the counts elapsed since the last call to ticks (interrupts must
+ * be disabled). */
+static void gpt_sync(void)
+{
+  uint8_t now = TCNT2;
+
+  gptSubTicks += (uint16_t)((uint8_t)(now - gptLastCount)) << GPT_COUNT_SHIFT;
+  gptLastCount = now;
+
+  while (gptSubTicks >= GPT_TICK_UNITS) {
+    gptSubTicks -= GPT_TICK_UNITS;
+    gptTime++;
+    gptPending++;
+  }
+}
+
+/** Sets the compare match to the next deadline (interrupts must be
+ * disabled). */
+static void gpt_schedule(void)
+{
+  uint16_t counts = GPT_MAX_COUNTS;
+  uint16_t units;
+  uint8_t elapsed;
+
+  if (gptHead >= 0
+      && gptTimerField[gptHead].delta < GPT_MAX_COUNTS + gptPending) {
+    if (gptTimerField[gptHead].delta > gptPending) {
+      units = (gptTimerField[gptHead].delta - gptPending) * GPT_TICK_UNITS
+	- gptSubTicks;
+      counts = (units + (1 << GPT_COUNT_SHIFT) - 1) >> GPT_COUNT_SHIFT;
+      if (counts > GPT_MAX_COUNTS)
+	counts = GPT_MAX_COUNTS;
+    } else
+      counts = 0; // already due
+  }
+
+  // counts are relative to gptLastCount, keep compare ahead of the counter
+  elapsed = TCNT2 - gptLastCount;
+  if (counts < elapsed + 2)
+    counts = elapsed + 2;
+
+  OCR2A = gptLastCount + counts;
+}
+#endif
+
+/** Starts a timer expiring the given number of ticks from now (interrupts
+ * must be disabled). */
+static void gpt_start(int8_t timerId, uint32_t ticks)
+{
+#if GPT_TICKLESS
+  gpt_sync();
+  gpt_insert(timerId, ticks + gptPending);
+  gpt_schedule();
+#else
+  gpt_insert(timerId, ticks + gptPending);
+#endif
+}
 
 void gpt_init()
 {
   uint8_t i;
 
   // mark timer elements as unused
-  for (i = 0; i < GPT_MAX_TIMERS; i++)
+  for (i = 0; i < GPT_MAX_TIMERS; i++) {
     gptTimerField[i].overflowTime = 0;
+    gptTimerField[i].queued = 0;
+  }
+  gptHead = -1;
 
+#if GPT_TICKLESS
+  // Timer 2 (8-Bit Timer) in normal mode, counter runs freely
+  TCCR2A = 0x00;
+  TCCR2B |= (7<<CS20); //prescaler = 1024, timer started
+  // tpuls = 64 us
+  gptLastCount = TCNT2;
+  OCR2A = gptLastCount + GPT_MAX_COUNTS;
+#else
   // Timer 2 (8-Bit Timer) in CTC mode
   TCCR2A = 0x02;
   TCCR2B |= (4<<CS20); //prescaler = 64, timer started
   // tpuls = 4 us
   OCR2A = 249; // 250 pulses => 1 ms interrupt
+#endif
   TIMSK2 |= (1<<OCIE2A); // enable compare match interrupt
 
   sei();
@@ -40,13 +226,64 @@ void gpt_init()
 
 uint32_t gpt_getTime()
 {
-  return gptTime;
+#if GPT_TICKLESS
+  uint32_t now;
+  uint8_t sreg = SREG;
+
+  cli();
+  gpt_sync();
+  now = gptTime;
+  SREG = sreg;
+
+  return now;
+#else
+  uint32_t now;
+  uint8_t sreg = SREG;
+
+  // 32-bit read is not atomic
+  cli();
+  now = gptTime;
+  SREG = sreg;
+
+  return now;
+#endif
+}
+
+uint32_t gpt_getTimeUs()
+{
+  uint32_t t;
+  uint8_t c;
+  uint8_t sreg = SREG;
+
+  cli();
+#if GPT_TICKLESS
+  gpt_sync();
+  t = gptTime;
+  c = gptSubTicks; // in 4us
+#else
+  t = gptTime;
+  c = TCNT2; // in 4us
+  // compare match pending, i.e., counter restarted but tick not counted yet
+  if ((TIFR2 & (1<<OCF2A)) && c < OCR2A)
+    t++;
+#endif
+  SREG = sreg;
+
+  return t * 1000 + (uint16_t)c * 4;
 }
 
-int8_t gpt_requestTimer(uint16_t overflowTime, void (*callback)(void))
+/** Request a GPT with deferred (event >= 0) or immediate callback. */
+static int8_t gpt_request(uint32_t overflowTime, void (*callback)(void),
+			  int8_t event, uint8_t oneShot)
 {
   uint8_t i;
   int8_t timerId = -1;
+  uint8_t sreg = SREG;
+
+  if (overflowTime == 0)
+    return -1;
+
+  cli();
 
   // search for a free timer element
   if (gptNrTimers < GPT_MAX_TIMERS)
@@ -57,8 +294,10 @@ int8_t gpt_requestTimer(uint16_t overflowTime, void (*callback)(void))
       {
 	// free element found
 	gptTimerField[i].callback = callback;
-	gptTimerField[i].remainingTime = overflowTime;
+	gptTimerField[i].event = event;
+	gptTimerField[i].oneShot = oneShot;
 	gptTimerField[i].overflowTime = overflowTime;
+	gpt_start(i, overflowTime);
 	timerId = i;
 	gptNrTimers++;
 	break;
@@ -66,48 +305,117 @@ int8_t gpt_requestTimer(uint16_t overflowTime, void (*callback)(void))
     }
   }
 
+  SREG = sreg;
   return timerId;
 }
 
-void gpt_setOverflowTime(uint16_t overflowTime, int8_t timerId)
+int8_t gpt_requestTimer(uint32_t overflowTime, void (*callback)(void))
+{
+  return gpt_request(overflowTime, callback, -1, 0);
+}
+
+int8_t gpt_requestTimerDeferred(uint32_t overflowTime, uint8_t priority,
+				void (*callback)(void))
 {
-  if (timerId >= 0 && timerId < GPT_MAX_TIMERS) {
-    gptTimerField[timerId].remainingTime = overflowTime;
+  int8_t event, timerId;
+
+  event = dispatch_request(priority, callback);
+  if (event < 0)
+    return -1;
+
+  timerId = gpt_request(overflowTime, callback, event, 0);
+  if (timerId < 0)
+    dispatch_release(event);
+
+  return timerId;
+}
+
+int8_t gpt_requestOneShot(uint32_t time, void (*callback)(void))
+{
+  return gpt_request(time, callback, -1, 1);
+}
+
+int8_t gpt_requestAt(uint32_t deadline, void (*callback)(void))
+{
+  int8_t timerId;
+  int32_t ticks;
+  uint8_t sreg = SREG;
+
+  cli();
+#if GPT_TICKLESS
+  gpt_sync();
+#endif
+  ticks = (int32_t)(deadline - gptTime);
+  if (ticks <= 0)
+    ticks = 1;
+  timerId = gpt_request(ticks, callback, -1, 1);
+  SREG = sreg;
+
+  return timerId;
+}
+
+void gpt_setOverflowTime(uint32_t overflowTime, int8_t timerId)
+{
+  uint8_t sreg = SREG;
+
+  if (timerId < 0 || timerId >= GPT_MAX_TIMERS || overflowTime == 0)
+    return;
+
+  cli();
+  if (gptTimerField[timerId].overflowTime != 0) {
+    gpt_unlink(timerId);
     gptTimerField[timerId].overflowTime = overflowTime;
-  } 
+    gpt_start(timerId, overflowTime);
+  }
+  SREG = sreg;
 }
 
 void gpt_reset(int8_t timerId)
 {
-  if(timerId >= 0 && timerId < GPT_MAX_TIMERS)
-    gptTimerField[timerId].remainingTime = gptTimerField[timerId].overflowTime;
+  uint8_t sreg = SREG;
+
+  if (timerId < 0 || timerId >= GPT_MAX_TIMERS)
+    return;
+
+  cli();
+  if (gptTimerField[timerId].overflowTime != 0) {
+    gpt_unlink(timerId);
+    gpt_start(timerId, gptTimerField[timerId].overflowTime);
+  }
+  SREG = sreg;
 }
 
 void gpt_releaseTimer(int8_t timerId)
 {
-  if(timerId >= 0 && timerId < GPT_MAX_TIMERS) {
+  uint8_t sreg = SREG;
+
+  if (timerId < 0 || timerId >= GPT_MAX_TIMERS)
+    return;
+
+  cli();
+  if (gptTimerField[timerId].overflowTime != 0) {
+    gpt_unlink(timerId);
     gptTimerField[timerId].overflowTime = 0;
     gptNrTimers--;
+    dispatch_release(gptTimerField[timerId].event);
   }
+  SREG = sreg;
 }
 
+#if GPT_TICKLESS
+// called on the next deadline, or at least every GPT_MAX_COUNTS counts
+ISR(TIMER2_COMPA_vect)
+{
+  gpt_sync();
+  gpt_expire();
+  gpt_schedule();
+}
+#else
 // called every 1ms
 ISR(TIMER2_COMPA_vect)
 {
-  uint8_t i;
-
   gptTime++;
-
-  for(i = 0; i < GPT_MAX_TIMERS; i++)
-  {
-    if(gptTimerField[i].overflowTime != 0) // is timer element used?
-    {
-      gptTimerField[i].remainingTime--;
-      if(gptTimerField[i].remainingTime == 0) // time ellapsed?
-      {
-	gptTimerField[i].remainingTime = gptTimerField[i].overflowTime;
-	(*(gptTimerField[i].callback))(); // call callback-function
-      }
-    }
-  }
+  gptPending++;
+  gpt_expire();
 }
+#endif
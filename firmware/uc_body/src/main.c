@@ -8,36 +8,135 @@
  *
  */
 
+#include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <string.h>
 #include "io.h"
 #include "uart0.h"
 #include "gpt.h"
 #include "motor.h"
+#include "encoder.h"
+#include "capture.h"
+#include "adc.h"
 #include "pwm.h"
+#include "steppermotor.h"
 #include "extint.h"
+#include "debounce.h"
+#include "dispatch.h"
+#include "protocol.h"
 
 #define STEP     (100)
+/** Settle time of the buttons (ms). */
+#define BUTTON_SETTLE     (20)
+/** Current limits of the DC motor (ADC value, 11 bit, current sense about
+ * 0.13 V/A, i.e., about 53 per A). */
+#define MOTOR_CURRENT_LIMIT     (745) // 14 A
+#define MOTOR_STALL_CURRENT     (320) // 6 A
+#define MOTOR_STALL_TIME        (500) // ms
+/** Profile of the stepper motor moves. */
+#define STEPPER_SPEED     (1000) // steps/s
+#define STEPPER_ACCEL     (4000) // steps/s^2
+/** Homing of the stepper motor at boot (index switch within a revolution,
+ * less than 1s). */
+#define STEPPER_HOME_RANGE      (200) // steps, one revolution
+#define STEPPER_HOME_SPEED      (1000) // steps/s
+#define STEPPER_HOME_SLOW       (200) // steps/s
+#define STEPPER_HOME_ACCEL      (20000) // steps/s^2
 
-void faster(void)
+/** DC motor (dome). */
+static motor_t dcMotor;
+/** Stepper motor. */
+static steppermotor_t stepper;
+
+/** Target position of the stepper motor. */
+static int32_t stepperTarget = 0;
+/** Stepper motor is homed at boot. */
+static uint8_t stepperHoming = 0;
+
+void telemetry(void)
 {
-  uint16_t i;
-  for(i = 0; i < 65500; i++); // debounce
+  struct {
+    uint32_t time;
+    int16_t speed;
+    int32_t position;
+    int32_t velocity;
+    uint16_t controlTime;
+    uint16_t current;
+    uint8_t fault;
+  } msg;
 
-  motor_inc(100);
+  msg.time = gpt_getTime();
+  msg.speed = motor_getSpeed(&dcMotor);
+  msg.position = steppermotor_position(&stepper);
+  msg.velocity = encoder_getVelocity();
+  msg.controlTime = motor_getControlTimeMax();
+  msg.current = motor_getCurrent(&dcMotor);
+  msg.fault = motor_getFault(&dcMotor);
+  protocol_send(PROTOCOL_ID_BODY_TELEMETRY, &msg, sizeof(msg));
+}
 
-  uart0_printInt16(motor_getSpeed());
-  uart0_println("");
+void faster(void)
+{
+  motor_inc(&dcMotor, STEP);
+  telemetry();
 }
 
 void slower(void)
 {
-  uint16_t i;
-  for(i = 0; i < 65500; i++); // debounce
+  motor_dec(&dcMotor, STEP);
+  telemetry();
+}
 
-  motor_dec(100);
+void cmd_motorSpeed(const uint8_t *payload, uint8_t length)
+{
+  int16_t speed;
 
-  uart0_printInt16(motor_getSpeed());
-  uart0_println("");
+  if (length != sizeof(speed))
+    return;
+
+  memcpy(&speed, payload, sizeof(speed));
+  motor_setSpeed(&dcMotor, speed);
+}
+
+void cmd_motorTarget(const uint8_t *payload, uint8_t length)
+{
+  int32_t target;
+
+  if (length != sizeof(target))
+    return;
+
+  memcpy(&target, payload, sizeof(target));
+  motor_setTargetSpeed(&dcMotor, target);
+}
+
+void cmd_motorClear(const uint8_t *payload, uint8_t length)
+{
+  motor_clearFault(&dcMotor);
+}
+
+void cmd_stepperMove(const uint8_t *payload, uint8_t length)
+{
+  int32_t steps;
+
+  if (length != sizeof(steps))
+    return;
+
+  memcpy(&steps, payload, sizeof(steps));
+  if (steppermotor_moveTo(&stepper, stepperTarget + steps, STEPPER_SPEED,
+			  STEPPER_ACCEL) == 0)
+    stepperTarget += steps; // queued
+}
+
+void stepper_moved(void)
+{
+  if (!stepperHoming)
+    return;
+
+  stepperHoming = 0;
+  if (steppermotor_homed(&stepper))
+    protocol_log_P(PROTOCOL_LOG_INFO, PSTR("stepper homed"));
+  else
+    protocol_log_P(PROTOCOL_LOG_ERROR, PSTR("stepper homing failed"));
 }
 
 void led_blink(void)
@@ -47,25 +146,74 @@ void led_blink(void)
 
 int main(void)
 {
-  uart0_init();
+  uart0_init(UART0_BAUD_115200);
+  protocol_init(); // frames only, messages via protocol_log_P
+  dispatch_init();
   gpt_init();
 
+  // buttons are debounced and handled in the main loop (deferred)
   extint_init();
-  if (extint_requestInt(4, EXTINT_TRIGGER_FALLING_EDGE, faster) == -1)
-    uart0_println("INT4 already used");
-  if (extint_requestInt(5, EXTINT_TRIGGER_FALLING_EDGE, slower) == -1)
-    uart0_println("INT5 already used");
+  debounce_init();
+  if (debounce_request(4, EXTINT_TRIGGER_FALLING_EDGE, BUTTON_SETTLE, 1,
+		       faster) == -1)
+    protocol_log_P(PROTOCOL_LOG_ERROR, PSTR("INT4 already used"));
+  if (debounce_request(5, EXTINT_TRIGGER_FALLING_EDGE, BUTTON_SETTLE, 2,
+		       slower) == -1)
+    protocol_log_P(PROTOCOL_LOG_ERROR, PSTR("INT5 already used"));
 
-  motor_init();
+  motor_init(&dcMotor, &MOTOR_PORT, &MOTOR_DDR, MOTOR_IN1, MOTOR_IN2,
+	     PWM_OC1A);
+  // full speed in 0.2s, brake 20ms
+  if (motor_setRamp(&dcMotor, 4000, 40000, 20) == -1)
+    protocol_log_P(PROTOCOL_LOG_ERROR, PSTR("motor jerk not reachable"));
+  encoder_init();
+  motor_setFeedback(&dcMotor, encoder_getPosition, encoder_getVelocity);
+  capture_init(); // units requested by the sensors (ICP4, ICP5)
+  // current sensing, 4x oversampled, filtered (alpha = 1/8)
+  adc_init();
+  motor_setCurrentSense(&dcMotor, adc_request(MOTOR_CURRENT_CHANNEL, 1, 3),
+			MOTOR_CURRENT_LIMIT, MOTOR_STALL_CURRENT,
+			MOTOR_STALL_TIME);
+
+  // stepper motor moves to the target (steps generated by timer 3)
+  steppermotor_init(&stepper, &STEPPERMOTOR_PORT, &STEPPERMOTOR_DDR,
+		    STEPPERMOTOR_A1, STEPPERMOTOR_A2, STEPPERMOTOR_B1,
+		    STEPPERMOTOR_B2, FULL);
+  steppermotor_setCallback(3, stepper_moved);
+  if (steppermotor_home(&stepper, STEPPERMOTOR_HOME_INT,
+			EXTINT_TRIGGER_FALLING_EDGE, STEPPER_HOME_RANGE,
+			STEPPER_HOME_SPEED, STEPPER_HOME_SLOW,
+			STEPPER_HOME_ACCEL) == 0)
+    stepperHoming = 1;
+  else
+    protocol_log_P(PROTOCOL_LOG_ERROR, PSTR("INT6 already used"));
+
+  // commands and telemetry
+  protocol_registerHandler(PROTOCOL_ID_MOTOR_SPEED, cmd_motorSpeed);
+  protocol_registerHandler(PROTOCOL_ID_STEPPER_MOVE, cmd_stepperMove);
+  protocol_registerHandler(PROTOCOL_ID_MOTOR_TARGET, cmd_motorTarget);
+  protocol_registerHandler(PROTOCOL_ID_MOTOR_CLEAR, cmd_motorClear);
+  gpt_requestTimerDeferred(100, 6, telemetry);
 
   // led blink test
   DDRA |= (1<<PA7);
   gpt_requestTimer(1000, led_blink);
   
-  uart0_println("initialized");
+  protocol_log_P(PROTOCOL_LOG_INFO, PSTR("initialized"));
 
   while(1) {
-    //sleep_mode();
+    dispatch();
+    protocol_poll();
+
+    // sleep until the next interrupt, unless an event or frame is pending
+    cli();
+    if (!dispatch_pending()  &&  !protocol_pending()) {
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+    }
+    sei();
   }
 
   return 0;
@@ -5,99 +5,715 @@
  *
  * @brief Implementation of DC motor driver.
  * 
- * Driver for a DC motor (2 inputs + 1 enable). Pins are connected to a L298N
+ * Driver for DC motors (2 inputs + 1 enable). Pins are connected to a L298N
  * motor driver IC.
+ *
+ * The PID speed controllers run in the compare match ISR of timer 0 (CTC
+ * mode) at the control rate, independent of the PWM frequency. The outputs
+ * are committed and applied at the next PWM period boundary (timer 1). The
+ * ISR enables interrupts at once (ISR_NOBLOCK), so the encoder ISR is
+ * serviced within its own latency. Only the snapshot of the feedback, the
+ * current check and staging the outputs run with interrupts disabled. An
+ * iteration still running when the next period starts makes the new one
+ * return at once (overrun). Worst-case stack: this ISR, a second instance
+ * returning at the busy check and one other ISR on top (all other ISRs
+ * block interrupts). The speed is the change of the encoder position per
+ * control period (low-pass filtered). The derivative acts on
+ * the measured speed (no kick on target changes) and is filtered too. The
+ * integral is limited and not increased while the output saturates
+ * (anti-windup). All terms are calculated in Q8.8 (PWM value * 256).
+ *
+ * The motor current (ADC scanner, optional) is checked at the begin of each
+ * control period, also in open loop. An overcurrent (last value) or a stall
+ * (filtered current above a threshold for some time while the encoder does
+ * not move) cuts the PWM at once (written directly to OCRnx, active at the
+ * next period boundary) and disables the motor until the fault is cleared.
+ *
+ * In open loop the speed may follow a ramp updated every MOTOR_RAMP_PERIOD
+ * ms (GPT). The ramp changes the speed (Q8.8) by a constant step, i.e., it
+ * limits the acceleration. The jerk is limited by a moving average over the
+ * last 2^n ramp values (S-curve), with 2^n about the time to reach the
+ * acceleration. When the direction reverses, the ramp goes to zero first,
+ * waits until the average settled at zero and brakes the motor (or lets it
+ * coast) before the bridge is switched.
  */
 
+#include <avr/interrupt.h>
 #include "motor.h"
 #include "pwm.h"
+#include "gpt.h"
+#include "adc.h"
 #include "io.h"	// port, pins definition
-static int16_t speed; // -PWM_TOP .. PWM_TOP
 
-void motor_init(void)
+/** Filter of the measured speed (as power of 2, i.e., alpha = 1/8). */
+#define MOTOR_SPEED_FILTER      3
+/** Filter of the derivative term (as power of 2). */
+#define MOTOR_DERIVATIVE_FILTER 2
+/** Limit of the control error (counts/s), keeps the products in 32 bit. */
+#define MOTOR_ERROR_MAX         65535L
+/** Limit of the PID terms (Q8.8). */
+#define MOTOR_TERM_MAX          ((int32_t)PWM_TOP << 9)
+/** Prescaler of timer 0 (control period). */
+#define MOTOR_CONTROL_PRESCALER 64
+/** Update period of the ramp (ms). */
+#define MOTOR_RAMP_PERIOD       1
+/** Maximum encoder counts within the stall time of a stalled motor. */
+#define MOTOR_STALL_COUNTS      2
+
+/** Motor instances. */
+static motor_t *motors[MOTOR_MAX_INSTANCES];
+static uint8_t numMotors = 0;
+
+// speed controllers (all motors, timer 0)
+static volatile uint8_t controlBusy = 0;
+static uint16_t controlRate; // Hz
+static volatile uint16_t controlTime = 0, controlTimeMax = 0; // us
+static volatile uint16_t controlOverruns = 0;
+
+/** Timer of the ramps (all motors). */
+static int8_t rampTimer = -1;
+
+int8_t motor_init(motor_t *motor, volatile uint8_t *port,
+		  volatile uint8_t *ddr, uint8_t in1, uint8_t in2,
+		  enum pwm_output enable)
 {
+  uint8_t sreg = SREG;
+
+  if (numMotors >= MOTOR_MAX_INSTANCES)
+    return -1;
+
+  motor->port = port;
+  motor->in1 = (1 << in1);
+  motor->in2 = (1 << in2);
+  motor->ocr = pwm_ocr(enable);
+  motor->output = pwm_index(enable);
+
   // init pins
   // value
-  SET_BIT(MOTOR_PORT, MOTOR_IN1);
-  CLEAR_BIT(MOTOR_PORT, MOTOR_IN2);
-  CLEAR_BIT(MOTOR_PORT, MOTOR_ENA);
+  *port = (*port & ~motor->in2) | motor->in1;
   // direction
-  SET_BIT(MOTOR_DDR, MOTOR_IN1);
-  SET_BIT(MOTOR_DDR, MOTOR_IN2);
-  SET_BIT(MOTOR_DDR, MOTOR_ENA);
+  *ddr |= motor->in1 | motor->in2;
+
+  pwm_init(enable, 0, PWM_MODE_FAST); // enable is output, 0
 
-  pwm_init(PWM_OC1A);
+  motor->speed = 0;
+  motor->direction = 1;
 
-  speed = 0;
-  pwm_set(PWM_OC1A, 0);
+  motor->rampTarget = 0;
+  motor->rampStep = 0;
+  motor->rampShift = 0;
+  motor->brakeTime = 0;
+  motor->brakeCount = 0;
+  motor->ramping = 0;
+
+  motor->feedback = 0;
+  motor->velocity = 0;
+  motor->controlEnabled = 0;
+  motor->targetSpeed = 0;
+  motor->measuredSpeed = 0;
+  motor->kp = 4; // to be tuned
+  motor->ki = 1;
+  motor->kd = 0;
+
+  motor->currentSlot = -1;
+  motor->stallCurrent = 0;
+  motor->stallTime = 0;
+  motor->fault = MOTOR_FAULT_NONE;
+
+  cli();
+  motors[numMotors++] = motor;
+  SREG = sreg;
+
+  if (numMotors == 1)
+    motor_setControlRate(MOTOR_CONTROL_RATE_MAX);
+
+  return 0;
 }
 
-void motor_inc(uint16_t step)
+/** Stages the speed on the bridge and the PWM (interrupts must be
+ * disabled, see pwm_commit). */
+static void motor_apply(motor_t *motor, int16_t newSpeed)
 {
-  int8_t changeDir = 0;
+  // limit
+  if (newSpeed > PWM_TOP)
+    newSpeed = PWM_TOP;
+  if (newSpeed < -PWM_TOP)
+    newSpeed = -PWM_TOP;
 
-  if (speed < 0  &&  speed + step > 0)
-    changeDir = 1;
-
-  // motor direction if sign of speed changes
-  if (changeDir) {
-    // TODO: set pins on port in 1 assignment
-    SET_BIT(MOTOR_PORT, MOTOR_IN1);
-    CLEAR_BIT(MOTOR_PORT, MOTOR_IN2);
+  // motor direction if sign of speed changes (keep direction at 0)
+  if (newSpeed > 0  &&  motor->direction <= 0) {
+    pwm_stagePins(motor->port, motor->in1 | motor->in2, motor->in1);
+    motor->direction = 1;
+  } else if (newSpeed < 0  &&  motor->direction >= 0) {
+    pwm_stagePins(motor->port, motor->in1 | motor->in2, motor->in2);
+    motor->direction = -1;
   }
 
-  // increase, what possible
-  if (speed <= ((int16_t)(PWM_TOP - step)))
-    speed += step;
-  else
-    speed = PWM_TOP;
+  motor->speed = newSpeed;
 
   // adapt speed
-  if (speed < 0)
-    pwm_set(PWM_OC1A, -speed);
+  if (newSpeed < 0)
+    pwm_stageOutput(motor->output, motor->ocr, -newSpeed);
   else
-    pwm_set(PWM_OC1A, speed);
+    pwm_stageOutput(motor->output, motor->ocr, newSpeed);
+}
+
+/** Stages a stop of the motor with both bridge inputs low, i.e., brakes
+ * (enable high) or coasts (enable low). The next speed sets the direction
+ * again. */
+static void motor_stop(motor_t *motor, uint8_t brake)
+{
+  pwm_stagePins(motor->port, motor->in1 | motor->in2, 0);
+  motor->direction = 0;
+
+  motor->speed = 0;
+  pwm_stageOutput(motor->output, motor->ocr, brake ? PWM_TOP : 0);
+}
+
+/** Returns 1 if any motor needs the control period (speed controller or
+ * current sensing, periodic != 0) or ramps (interrupts must be
+ * disabled). */
+static uint8_t motor_any(uint8_t periodic)
+{
+  uint8_t i;
+
+  for (i = 0; i < numMotors; i++)
+    if (periodic ? (motors[i]->controlEnabled  ||  motors[i]->currentSlot >= 0)
+	: motors[i]->ramping)
+      return 1;
+
+  return 0;
 }
 
-void motor_dec(uint16_t step)
+/** Enables or disables the interrupt of the control period (interrupts must
+ * be disabled). */
+static void motor_setControlInterrupt(uint8_t enable)
 {
-  int8_t changeDir = 0;
+  if (enable  &&  !IS_BIT_SET(TIMSK0, OCIE0A)) {
+    TCNT0 = 0;
+    TIFR0 = (1 << OCF0A); // clear pending interrupt (by writing a one)
+    SET_BIT(TIMSK0, OCIE0A);
+  } else if (!enable)
+    CLEAR_BIT(TIMSK0, OCIE0A);
+}
 
-  if (speed >= 0  &&  speed - step < 0)
-    changeDir = 1;
+/** Disables the speed controller (interrupts must be disabled). */
+static void motor_stopControl(motor_t *motor)
+{
+  motor->controlEnabled = 0;
+  if (!motor_any(1))
+    motor_setControlInterrupt(0);
+}
 
-  // motor direction if sign of speed changes
-  if (changeDir) {
-    // TODO: set pins on port in 1 assignment
-    CLEAR_BIT(MOTOR_PORT, MOTOR_IN1);
-    SET_BIT(MOTOR_PORT, MOTOR_IN2);
+/** Stops the ramp (interrupts must be disabled). */
+static void motor_stopRamp(motor_t *motor)
+{
+  motor->ramping = 0;
+  motor->brakeCount = 0;
+  if (!motor_any(0)) {
+    gpt_releaseTimer(rampTimer);
+    rampTimer = -1;
   }
+}
 
-  // decrease, what possible
-  if (speed >= ((int16_t)(-PWM_TOP + step)))
-    speed -= (int16_t) step;
-  else
-    speed = -PWM_TOP;
+/** Restarts the moving average at the current speed (interrupts must be
+ * disabled). */
+static void motor_resetAverage(motor_t *motor)
+{
+  uint8_t i;
 
-  // adapt speed
-  if (speed < 0)
-    pwm_set(PWM_OC1A, -speed);
+  for (i = 0; i < (1 << motor->rampShift); i++)
+    motor->rampHistory[i] = motor->speed;
+  motor->rampIndex = 0;
+  motor->rampSum = (int32_t)motor->speed << motor->rampShift;
+  motor->ramp = (int32_t)motor->speed << 8;
+}
+
+/** One step of the ramp of a motor. */
+static void motor_rampStep(motor_t *motor)
+{
+  int32_t target = (int32_t)motor->rampTarget << 8;
+  int16_t out;
+
+  if (motor->brakeCount > 0) {
+    motor->brakeCount--;
+    return;
+  }
+
+  // reversal, reach zero first
+  if ((motor->rampTarget > 0  &&  motor->direction < 0)
+      || (motor->rampTarget < 0  &&  motor->direction > 0))
+    target = 0;
+
+  // limit acceleration
+  if (motor->ramp < target - motor->rampStep)
+    motor->ramp += motor->rampStep;
+  else if (motor->ramp > target + motor->rampStep)
+    motor->ramp -= motor->rampStep;
   else
-    pwm_set(PWM_OC1A, speed);
+    motor->ramp = target;
+
+  // limit jerk
+  motor->rampSum -= motor->rampHistory[motor->rampIndex];
+  motor->rampHistory[motor->rampIndex] = motor->ramp >> 8;
+  motor->rampSum += motor->rampHistory[motor->rampIndex];
+  motor->rampIndex = (motor->rampIndex + 1) & ((1 << motor->rampShift) - 1);
+  out = motor->rampSum >> motor->rampShift;
+
+  if (target == 0  &&  motor->rampTarget != 0  &&  motor->rampSum == 0) {
+    // settled at zero, change direction
+    motor_stop(motor, motor->brakeTime > 0);
+    motor->brakeCount = motor->brakeTime / MOTOR_RAMP_PERIOD;
+    return;
+  }
+
+  motor_apply(motor, out);
+
+  if (motor->ramp == target
+      && motor->rampSum == ((int32_t)motor->rampTarget << motor->rampShift)
+      && target == ((int32_t)motor->rampTarget << 8))
+    motor_stopRamp(motor); // done
+}
+
+/** Ramps of all motors (called by the GPT). */
+static void motor_ramp(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < numMotors; i++)
+    if (motors[i]->ramping)
+      motor_rampStep(motors[i]);
+  pwm_commit();
+}
+
+void motor_setSpeed(motor_t *motor, int16_t newSpeed)
+{
+  uint8_t sreg = SREG;
+
+  if (motor->fault)
+    return;
+
+  // limit
+  if (newSpeed > PWM_TOP)
+    newSpeed = PWM_TOP;
+  if (newSpeed < -PWM_TOP)
+    newSpeed = -PWM_TOP;
+
+  cli();
+  if (motor->controlEnabled)
+    motor_stopControl(motor);
+  motor->rampTarget = newSpeed;
+
+  if (motor->rampStep == 0) {
+    motor_apply(motor, newSpeed);
+  } else if (!motor->ramping) {
+    motor_resetAverage(motor);
+    if (rampTimer < 0)
+      rampTimer = gpt_requestTimer(MOTOR_RAMP_PERIOD, motor_ramp);
+    if (rampTimer < 0)
+      motor_apply(motor, newSpeed); // no timer available
+    else
+      motor->ramping = 1;
+  }
+  pwm_commit();
+  SREG = sreg;
+}
+
+int8_t motor_setRamp(motor_t *motor, uint16_t acceleration, uint16_t jerk,
+		     uint16_t brakeTime)
+{
+  uint8_t sreg = SREG;
+  uint32_t accelTime = 0;
+  uint8_t shift = 0;
+
+  // time to reach the acceleration (ramp periods), average over the next
+  // power of 2
+  if (acceleration > 0  &&  jerk > 0) {
+    accelTime = ((uint32_t)acceleration * 1000UL)
+      / ((uint32_t)jerk * MOTOR_RAMP_PERIOD);
+    while (shift < MOTOR_RAMP_AVERAGE_MAX  &&  (1UL << shift) < accelTime)
+      shift++;
+  }
+
+  cli();
+  motor->rampStep = ((uint32_t)acceleration * 256UL * MOTOR_RAMP_PERIOD)
+    / 1000UL;
+  if (acceleration > 0  &&  motor->rampStep == 0)
+    motor->rampStep = 1;
+  motor->rampShift = shift;
+  motor->brakeTime = brakeTime;
+  motor_resetAverage(motor);
+  if (motor->rampStep == 0  &&  motor->ramping) {
+    // ramp off, set speed at once
+    motor_stopRamp(motor);
+    motor_apply(motor, motor->rampTarget);
+    pwm_commit();
+  }
+  SREG = sreg;
+
+  // jerk not reachable with the longest average
+  return ((1UL << shift) < accelTime) ? -1 : 0;
+}
+
+uint8_t motor_ramping(motor_t *motor)
+{
+  return motor->ramping;
 }
 
-int16_t motor_getSpeed(void)
+void motor_inc(motor_t *motor, uint16_t step)
 {
-  return speed;
+  // increase, what possible
+  int32_t newSpeed = (int32_t)(motor->controlEnabled ? motor->speed
+			       : motor->rampTarget) + step;
+
+  if (newSpeed > PWM_TOP)
+    newSpeed = PWM_TOP;
+  motor_setSpeed(motor, newSpeed);
 }
 
-int8_t motor_getDirection(void)
+void motor_dec(motor_t *motor, uint16_t step)
 {
-  if (speed > 0)
+  // decrease, what possible
+  int32_t newSpeed = (int32_t)(motor->controlEnabled ? motor->speed
+			       : motor->rampTarget) - step;
+
+  if (newSpeed < -PWM_TOP)
+    newSpeed = -PWM_TOP;
+  motor_setSpeed(motor, newSpeed);
+}
+
+int16_t motor_getSpeed(motor_t *motor)
+{
+  return motor->speed;
+}
+
+int8_t motor_getDirection(motor_t *motor)
+{
+  if (motor->speed > 0)
     return 1;
 
-  if (speed < 0)
+  if (motor->speed < 0)
     return -1;
 
   return 0;
 }
+
+/** Limits a value to -limit .. limit. */
+static inline int32_t motor_clamp(int32_t value, int32_t limit)
+{
+  if (value > limit)
+    return limit;
+  if (value < -limit)
+    return -limit;
+  return value;
+}
+
+/** One iteration of the PID speed controller of a motor with the position
+ * of the snapshot, returns the new speed (interrupts may be enabled). */
+static int16_t motor_pid(motor_t *motor, int32_t position)
+{
+  int32_t error, p, i, output;
+
+  // measured speed
+  motor->measuredSpeed += ((position - motor->lastPosition)
+			   * (int32_t)controlRate
+			   - motor->measuredSpeed) >> MOTOR_SPEED_FILTER;
+  motor->lastPosition = position;
+
+  // proportional
+  error = motor_clamp(motor->targetSpeed - motor->measuredSpeed,
+		      MOTOR_ERROR_MAX);
+  p = motor_clamp((int32_t)motor->kp * error, MOTOR_TERM_MAX);
+
+  // derivative (on measurement), low-pass filtered
+  motor->derivative +=
+    (motor_clamp(-(int32_t)motor->kd
+		 * motor_clamp(motor->measuredSpeed - motor->lastSpeed,
+			       MOTOR_ERROR_MAX),
+		 MOTOR_TERM_MAX)
+     - motor->derivative) >> MOTOR_DERIVATIVE_FILTER;
+  motor->lastSpeed = motor->measuredSpeed;
+
+  // integral, only if the output does not saturate in the direction of the
+  // error (anti-windup)
+  i = motor_clamp((int32_t)motor->ki * error, MOTOR_TERM_MAX);
+  output = p + motor->integral + i + motor->derivative;
+  if (!(output > ((int32_t)PWM_TOP << 8)  &&  error > 0)
+      && !(output < -((int32_t)PWM_TOP << 8)  &&  error < 0))
+    motor->integral = motor_clamp(motor->integral + i,
+				  (int32_t)PWM_TOP << 8);
+
+  return motor_clamp((p + motor->integral + motor->derivative) >> 8,
+		     PWM_TOP);
+}
+
+/** Cuts the PWM of a motor and disables ramp and speed controller
+ * (interrupts must be disabled). */
+static void motor_cut(motor_t *motor, uint8_t fault)
+{
+  motor->fault = fault;
+  if (motor->controlEnabled)
+    motor_stopControl(motor);
+  if (motor->ramping)
+    motor_stopRamp(motor);
+  motor->rampTarget = 0;
+  motor_stop(motor, 0);
+  pwm_commit();
+  // immediately, the committed stop is applied at the next period boundary
+  pwm_setScaled(motor->output, motor->ocr, 0, 0);
+}
+
+/** Checks the current of a motor with the position of the snapshot
+ * (interrupts must be disabled). */
+static void motor_protect(motor_t *motor, int32_t position)
+{
+  if (motor->currentSlot < 0  ||  motor->fault)
+    return;
+
+  if (adc_getLast(motor->currentSlot) >= motor->currentLimit) {
+    motor_cut(motor, MOTOR_FAULT_OVERCURRENT);
+    return;
+  }
+
+  if (motor->stallCurrent == 0
+      ||  adc_getFiltered(motor->currentSlot) < motor->stallCurrent) {
+    motor->stallCount = 0;
+    return;
+  }
+
+  // high current, stalled if the motor did not move within the stall time
+  if (motor->stallCount == 0)
+    motor->stallPosition = position;
+  if (++motor->stallCount < motor->stallPeriods)
+    return;
+
+  if (position - motor->stallPosition <= MOTOR_STALL_COUNTS
+      &&  motor->stallPosition - position <= MOTOR_STALL_COUNTS)
+    motor_cut(motor, MOTOR_FAULT_STALL);
+  else
+    motor->stallCount = 0; // moving, high load
+}
+
+// timer 0 compare match, i.e., control period (speed controllers),
+// interrupts enabled at entry
+ISR(TIMER0_COMPA_vect, ISR_NOBLOCK)
+{
+  int32_t positions[MOTOR_MAX_INSTANCES];
+  int16_t outputs[MOTOR_MAX_INSTANCES];
+  uint32_t start;
+  uint8_t i;
+
+  cli();
+  if (controlBusy) {
+    controlOverruns++; // previous iteration still running, skip this one
+    return;
+  }
+  controlBusy = 1;
+
+  // snapshot of the feedback and current check of all motors
+  for (i = 0; i < numMotors; i++) {
+    positions[i] = motors[i]->feedback ? (*motors[i]->feedback)() : 0;
+    motor_protect(motors[i], positions[i]);
+  }
+  sei();
+
+  start = gpt_getTimeUs();
+  for (i = 0; i < numMotors; i++)
+    if (motors[i]->controlEnabled)
+      outputs[i] = motor_pid(motors[i], positions[i]);
+
+  cli();
+  for (i = 0; i < numMotors; i++)
+    if (motors[i]->controlEnabled)
+      motor_apply(motors[i], outputs[i]);
+  pwm_commit();
+
+  // execution time of the controllers (including nested interrupts)
+  controlTime = gpt_getTimeUs() - start;
+  if (controlTime > controlTimeMax)
+    controlTimeMax = controlTime;
+  controlBusy = 0;
+}
+
+void motor_setFeedback(motor_t *motor, int32_t (*position)(void),
+		       int32_t (*velocity)(void))
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  if (motor->controlEnabled  &&  !position)
+    motor_stopControl(motor);
+  motor->feedback = position;
+  motor->velocity = velocity;
+  SREG = sreg;
+}
+
+void motor_setTargetSpeed(motor_t *motor, int32_t target)
+{
+  uint8_t sreg = SREG;
+
+  if (!motor->feedback  ||  motor->fault)
+    return;
+
+  cli();
+  motor->targetSpeed = target;
+  if (!motor->controlEnabled) {
+    if (motor->ramping)
+      motor_stopRamp(motor);
+    // bumpless start from the current PWM value and speed
+    motor->lastPosition = (*motor->feedback)();
+    motor->measuredSpeed = motor->velocity ? (*motor->velocity)() : 0;
+    motor->lastSpeed = motor->measuredSpeed;
+    motor->integral = (int32_t)motor->speed << 8;
+    motor->derivative = 0;
+    motor_setControlInterrupt(1);
+    motor->controlEnabled = 1;
+  }
+  SREG = sreg;
+}
+
+int32_t motor_getTargetSpeed(motor_t *motor)
+{
+  int32_t target;
+  uint8_t sreg = SREG;
+
+  cli();
+  target = motor->targetSpeed;
+  SREG = sreg;
+
+  return target;
+}
+
+int32_t motor_getMeasuredSpeed(motor_t *motor)
+{
+  int32_t measured;
+  uint8_t sreg = SREG;
+
+  cli();
+  measured = motor->measuredSpeed;
+  SREG = sreg;
+
+  return measured;
+}
+
+void motor_setGains(motor_t *motor, int16_t kp, int16_t ki, int16_t kd)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  motor->kp = kp;
+  motor->ki = ki;
+  motor->kd = kd;
+  SREG = sreg;
+}
+
+/** Converts the stall time to control periods (interrupts must be
+ * disabled). */
+static void motor_setStallPeriods(motor_t *motor)
+{
+  motor->stallPeriods = ((uint32_t)motor->stallTime * controlRate + 999)
+    / 1000;
+  if (motor->stallPeriods == 0)
+    motor->stallPeriods = 1;
+}
+
+void motor_setCurrentSense(motor_t *motor, int8_t slot, uint16_t limit,
+			   uint16_t stallCurrent, uint16_t stallTime)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  motor->currentLimit = limit;
+  motor->stallCurrent = stallCurrent;
+  motor->stallTime = stallTime;
+  motor->stallCount = 0;
+  motor_setStallPeriods(motor);
+  motor->currentSlot = slot;
+  motor_setControlInterrupt(motor_any(1));
+  SREG = sreg;
+}
+
+uint16_t motor_getCurrent(motor_t *motor)
+{
+  if (motor->currentSlot < 0)
+    return 0;
+
+  return adc_getFiltered(motor->currentSlot);
+}
+
+uint8_t motor_getFault(motor_t *motor)
+{
+  return motor->fault;
+}
+
+void motor_clearFault(motor_t *motor)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  motor->stallCount = 0;
+  motor->fault = MOTOR_FAULT_NONE;
+  SREG = sreg;
+}
+
+uint16_t motor_setControlRate(uint16_t rate)
+{
+  uint16_t counts;
+  uint8_t i;
+  uint8_t sreg = SREG;
+
+  if (rate < MOTOR_CONTROL_RATE_MIN)
+    rate = MOTOR_CONTROL_RATE_MIN;
+  if (rate > MOTOR_CONTROL_RATE_MAX)
+    rate = MOTOR_CONTROL_RATE_MAX;
+
+  // timer 0 in CTC mode, TOP = OCR0A (fits into 8 bit for the rate limits)
+  counts = (FOSZ / MOTOR_CONTROL_PRESCALER + rate/2) / rate;
+
+  cli();
+  TCCR0A = (1 << WGM01);
+  TCCR0B = (1 << CS01) | (1 << CS00); // prescaler 64
+  OCR0A = counts - 1;
+  controlRate = FOSZ / MOTOR_CONTROL_PRESCALER / counts;
+  for (i = 0; i < numMotors; i++)
+    motor_setStallPeriods(motors[i]);
+  SREG = sreg;
+
+  return controlRate;
+}
+
+uint16_t motor_getControlTime(void)
+{
+  uint16_t time;
+  uint8_t sreg = SREG;
+
+  cli();
+  time = controlTime;
+  SREG = sreg;
+
+  return time;
+}
+
+uint16_t motor_getControlTimeMax(void)
+{
+  uint16_t time;
+  uint8_t sreg = SREG;
+
+  cli();
+  time = controlTimeMax;
+  SREG = sreg;
+
+  return time;
+}
+
+uint16_t motor_controlOverruns(void)
+{
+  uint16_t overruns;
+  uint8_t sreg = SREG;
+
+  cli();
+  overruns = controlOverruns;
+  SREG = sreg;
+
+  return overruns;
+}
@@ -0,0 +1,217 @@
+/**
+ * @file protocol.c
+ * @author Denise Ratasich
+ * @date 17.10.2026
+ *
+ * @brief Implementation of the binary command/telemetry protocol.
+ *
+ * COBS (consistent overhead byte stuffing) replaces each 0x00 of a message by
+ * the distance to the next 0x00, so 0x00 can be used as frame delimiter. The
+ * overhead is 1 byte per message (up to 254 bytes).
+ */
+
+#include <stddef.h>	// NULL
+#include <util/crc16.h>
+#include "protocol.h"
+#include "uart0.h"
+#include "gpt.h"
+
+/** Handler of each message ID. */
+static protocol_handler_t handlers[PROTOCOL_MAX_IDS];
+
+/** Decoded message (ID, payload, CRC). */
+static uint8_t message[UART0_RX_SIZE];
+
+/** Number of invalid frames. */
+static uint16_t errors = 0;
+
+/** Baud rate switch not yet confirmed by the host. */
+static uint8_t baudPending = 0;
+/** Baud rate before the switch. */
+static enum uart0_baud baudPrevious;
+/** Time of the switch (us). */
+static uint32_t baudSince;
+
+/** Decodes a COBS frame (without delimiter). Returns the length of the
+ * decoded data or -1 on encoding errors. */
+static int16_t protocol_decode(const uint8_t *in, uint8_t length, uint8_t *out)
+{
+  uint8_t i = 0, o = 0, code, k;
+
+  while (i < length) {
+    code = in[i++];
+    if (code == 0)
+      return -1;
+
+    for (k = 1; k < code; k++) {
+      if (i >= length)
+	return -1;
+      out[o++] = in[i++];
+    }
+
+    // implicit zero, except at the end of the frame or after a full block
+    if (code < 0xFF && i < length)
+      out[o++] = 0;
+  }
+
+  return o;
+}
+
+/** Encodes data with COBS and sends it (without delimiter). */
+static void protocol_encode(const uint8_t *data, uint8_t length)
+{
+  uint8_t start = 0, end, k;
+
+  while (1) {
+    // a block ends at the next zero, the end of data or after 254 bytes
+    end = start;
+    while (end < length  &&  data[end] != 0  &&  end - start < 0xFE)
+      end++;
+
+    uart0_putc(end - start + 1);
+    for (k = start; k < end; k++)
+      uart0_putc(data[k]);
+
+    if (end == length)
+      break;
+
+    if (data[end] == 0)
+      start = end + 1; // zero is replaced by the code of the next block
+    else
+      start = end; // full block without zero
+  }
+}
+
+/** Handles a baud rate switch request. */
+static void protocol_baud(const uint8_t *payload, uint8_t length)
+{
+  if (length != 1  ||  payload[0] >= UART0_BAUD_NUM)
+    return;
+
+  // acknowledge with current baud rate, then switch
+  protocol_send(PROTOCOL_ID_BAUD, payload, 1);
+  if (payload[0] == uart0_getBaud())
+    return;
+
+  baudPrevious = uart0_getBaud();
+  uart0_setBaud(payload[0]);
+  baudSince = gpt_getTimeUs();
+  baudPending = 1;
+}
+
+void protocol_init(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < PROTOCOL_MAX_IDS; i++)
+    handlers[i] = NULL;
+
+  handlers[PROTOCOL_ID_BAUD] = protocol_baud;
+
+  uart0_enableFrames('\0');
+}
+
+int8_t protocol_registerHandler(uint8_t id, protocol_handler_t handler)
+{
+  if (id >= PROTOCOL_MAX_IDS)
+    return -1;
+
+  handlers[id] = handler;
+  return id;
+}
+
+uint8_t protocol_pending(void)
+{
+  return uart0_frameAvailable();
+}
+
+void protocol_poll(void)
+{
+  const char *frame;
+  uint8_t length;
+  int16_t n;
+  uint16_t crc;
+  uint8_t i;
+
+  while ((frame = uart0_getFrame(&length)) != NULL) {
+    if (length == 0) {
+      // empty frame, e.g., delimiter sent by host to synchronize
+      uart0_releaseFrame();
+      continue;
+    }
+
+    n = protocol_decode((const uint8_t*) frame, length, message);
+    uart0_releaseFrame();
+
+    // at least ID and CRC
+    if (n < 3) {
+      errors++;
+      continue;
+    }
+
+    crc = 0;
+    for (i = 0; i < n - 2; i++)
+      crc = _crc_xmodem_update(crc, message[i]);
+    if ((crc & 0xFF) != message[n-2]  ||  (crc >> 8) != message[n-1]) {
+      errors++;
+      continue;
+    }
+
+    // valid message confirms baud rate
+    baudPending = 0;
+
+    if (message[0] >= PROTOCOL_MAX_IDS  ||  handlers[message[0]] == NULL) {
+      errors++;
+      continue;
+    }
+
+    (*(handlers[message[0]]))(&message[1], n - 3);
+  }
+
+  // host didn't confirm new baud rate
+  if (baudPending
+      &&  (uint32_t)(gpt_getTimeUs() - baudSince) > PROTOCOL_BAUD_TIMEOUT) {
+    uart0_setBaud(baudPrevious);
+    baudPending = 0;
+  }
+}
+
+void protocol_send(uint8_t id, const void *payload, uint8_t length)
+{
+  uint8_t data[PROTOCOL_MAX_PAYLOAD + 3];
+  uint16_t crc = 0;
+  uint8_t i;
+
+  if (length > PROTOCOL_MAX_PAYLOAD)
+    return;
+
+  data[0] = id;
+  for (i = 0; i < length; i++)
+    data[i+1] = ((const uint8_t*) payload)[i];
+  for (i = 0; i < length + 1; i++)
+    crc = _crc_xmodem_update(crc, data[i]);
+  data[length+1] = crc & 0xFF;
+  data[length+2] = crc >> 8;
+
+  protocol_encode(data, length + 3);
+  uart0_putc('\0');
+}
+
+void protocol_log_P(uint8_t level, PGM_P text)
+{
+  uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+  uint8_t length = 1;
+  char c;
+
+  payload[0] = level;
+  while (length < PROTOCOL_MAX_PAYLOAD
+	 &&  (c = pgm_read_byte(text++)) != '\0')
+    payload[length++] = c;
+
+  protocol_send(PROTOCOL_ID_LOG, payload, length);
+}
+
+uint16_t protocol_errors(void)
+{
+  return errors;
+}
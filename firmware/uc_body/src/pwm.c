@@ -5,102 +5,433 @@
  *
  * @brief Implementation of PWM driver.
  * 
- * Generates PWM signals on OC1A.
+ * Generates PWM signals on the output compare channels of timer 1, 3, 4 and
+ * 5. All timers run with the same mode, prescaler and TOP = ICRn and are
+ * started together. Duty cycles are given in 0 .. PWM_TOP and scaled to
+ * TOP.
+ *
+ * Committed changes are applied at the period boundary of timer 1, i.e., in
+ * the overflow ISR in fast PWM mode (TOV1 is set at TOP = ICR1, the timer
+ * continues at BOTTOM with the next clock) and in the capture ISR in phase
+ * correct mode (ICF1 is set at TOP = ICR1). The duty cycles are written to
+ * OCRnx, which the timers take over at the next boundary (BOTTOM in fast,
+ * TOP in phase correct mode). The ISR runs some cycles after the boundary,
+ * so pins written in it would switch while the outputs already run with the
+ * new duty cycles. A commit with pins therefore writes 0 to its outputs
+ * first, and the pins and duty cycles in the ISR of the next boundary, when
+ * the outputs are off for a period.
  */
 
 #include <avr/interrupt.h>
 #include "pwm.h"
 #include "io.h"	// pin macros
 
-/** Current value of OCR1A. */
-static uint16_t ocr1a;
+/** Control registers of a 16-bit timer. */
+typedef struct {
+  volatile uint8_t *tccra;
+  volatile uint8_t *tccrb;
+  volatile uint16_t *icr;
+  volatile uint16_t *tcnt;
+  volatile uint8_t *ddr; // port of the output compare pins
+  uint8_t pins[3]; // output compare pins A, B, C
+} PwmTimerStruct_t;
+
+/** Timers 1, 3, 4, 5 (index = bit position of the outputs / 4). */
+static const PwmTimerStruct_t pwmTimers[4] = {
+  { &TCCR1A, &TCCR1B, &ICR1, &TCNT1, &PWM_OC1_DDR,
+    { PWM_OC1A_PIN, PWM_OC1B_PIN, PWM_OC1C_PIN } },
+  { &TCCR3A, &TCCR3B, &ICR3, &TCNT3, &PWM_OC3_DDR,
+    { PWM_OC3A_PIN, PWM_OC3B_PIN, PWM_OC3C_PIN } },
+  { &TCCR4A, &TCCR4B, &ICR4, &TCNT4, &PWM_OC4_DDR,
+    { PWM_OC4A_PIN, PWM_OC4B_PIN, PWM_OC4C_PIN } },
+  { &TCCR5A, &TCCR5B, &ICR5, &TCNT5, &PWM_OC5_DDR,
+    { PWM_OC5A_PIN, PWM_OC5B_PIN, PWM_OC5C_PIN } },
+};
+
+/** Timers running in PWM mode (bit i .. pwmTimers[i]). */
+static uint8_t pwmTimersUsed = 0;
+/** Outputs in use (enum pwm_output). */
+static uint16_t pwmOutputsUsed = 0;
+
+/** Prescalers (clock select 1 .. 5). */
+static const uint16_t pwmPrescalers[5] = { 1, 8, 64, 256, 1024 };
+
+/** Scale of the duty cycles (TOP/PWM_TOP, Q16). */
+uint32_t pwmScale = 65536UL; // TOP = PWM_TOP
+static uint16_t pwmTop = PWM_TOP;
+static uint8_t pwmClockSelect = 1; // no prescaler
+static enum pwm_mode pwmMode = PWM_MODE_FAST;
+/** Duty cycles (0 .. PWM_TOP, kept to rescale without accumulating rounding
+ * errors). */
+uint16_t pwmDuty[PWM_NUM_OUTPUTS];
+
+/** Pins of a port to be changed with a commit. */
+typedef struct {
+  volatile uint8_t *port;
+  uint8_t mask;
+  uint8_t value;
+} PwmPinsStruct_t;
+
+/** Duty cycle of an output to be changed with a commit (resolved when
+ * staged, so the ISR writes the register directly). */
+typedef struct {
+  volatile uint16_t *ocr;
+  uint8_t index; // bit position of the output
+  uint16_t value; // 0 .. PWM_TOP
+  uint16_t counts; // value scaled to TOP
+} PwmOutputStruct_t;
+
+/** Set of staged changes (duty cycles and pins). */
+typedef struct {
+  PwmOutputStruct_t outputs[PWM_NUM_OUTPUTS]; // changed outputs only
+  uint8_t numOutputs;
+  PwmPinsStruct_t pins[PWM_MAX_PORTS];
+  uint8_t numPins;
+} PwmStageStruct_t;
+
+/** Changes staged by the callers. */
+static PwmStageStruct_t pwmStaged;
+/** Changes committed, applied at the next period boundary. */
+static PwmStageStruct_t pwmCommitted;
+static volatile uint8_t pwmCommitPending = 0;
+/** Commit with pins, applied at the period boundary after its outputs have
+ * been set to 0 (when the outputs are off). */
+static PwmStageStruct_t pwmDelayed;
+
+/** Converts a duty cycle (0 .. PWM_TOP) to timer counts (0 .. TOP). */
+static inline uint16_t pwm_counts(uint16_t value)
+{
+  return ((uint32_t)value * pwmScale) >> 16;
+}
 
-/** Sets current value of OCR1A and applies it to the output compare unit. */
-static inline void pwm_setOCR1A(uint16_t newOcr1a)
+/** Enables or disables the period interrupt depending on the pending
+ * commits (interrupts must be disabled). */
+static void pwm_updateInterrupt(void)
 {
-  ocr1a = newOcr1a;
-  OCR1A = ocr1a;
+  // interrupt at the period boundary of the current mode
+  uint8_t flag = (pwmMode == PWM_MODE_FAST) ? TOV1 : ICF1;
+  uint8_t enable = (pwmMode == PWM_MODE_FAST) ? TOIE1 : ICIE1;
+
+  if (pwmCommitPending  ||  pwmDelayed.numPins) {
+    if (!IS_BIT_SET(TIMSK1, enable)) {
+      TIFR1 = (1 << flag); // clear pending interrupt (by writing a one)
+      SET_BIT(TIMSK1, enable);
+    }
+    TIMSK1 &= ~(1 << ((pwmMode == PWM_MODE_FAST) ? ICIE1 : TOIE1));
+  } else
+    TIMSK1 &= ~((1 << TOIE1) | (1 << ICIE1));
 }
 
-void pwm_init(uint8_t oc_mask)
+/** Sets mode, TOP and prescaler of the used timers and restarts them
+ * together, so they reach BOTTOM at the same time (within a few CPU cycles)
+ * and committed changes apply in lockstep (interrupts must be disabled). */
+static void pwm_configure(void)
 {
-  // mode "Fast PWM, top ICR" (WGM1: 0xE)
-  SET_BIT(TCCR1B, WGM13);
-  SET_BIT(TCCR1B, WGM12);
-  SET_BIT(TCCR1A, WGM11);
-  CLEAR_BIT(TCCR1A, WGM10);
+  uint8_t t;
+  const PwmTimerStruct_t *timer;
 
-  // set top value of timer (10kHz -> period: 100us)
-  ICR1 = PWM_TOP;
+  for (t = 0; t < 4; t++) {
+    if (!(pwmTimersUsed & (1 << t)))
+      continue;
+    timer = &pwmTimers[t];
 
-  // init compare match units
-  if (oc_mask & PWM_OC1A) {
-    // clear on compare match, set at bottom
-    SET_BIT(TCCR1A, COM1A1);
-    CLEAR_BIT(TCCR1A, COM1A0);
-    // set initial motor speed to 0
-    pwm_setOCR1A(0);
+    *timer->tccrb &= ~0x07; // stop
+    // mode "Fast PWM, top ICR" (WGMn: 0xE) or "PWM, Phase Correct, top ICR"
+    // (WGMn: 0xA), bits equal for all timers
+    if (pwmMode == PWM_MODE_FAST)
+      *timer->tccrb |= (1<<WGM13) | (1<<WGM12);
+    else
+      *timer->tccrb = (*timer->tccrb & ~(1<<WGM12)) | (1<<WGM13);
+    *timer->tccra = (*timer->tccra & ~(1<<WGM10)) | (1<<WGM11);
+    *timer->icr = pwmTop;
+    *timer->tcnt = 0;
   }
 
-  // clock source: no prescaler
-  CLEAR_BIT(TCCR1B, CS12);
-  CLEAR_BIT(TCCR1B, CS11);
-  SET_BIT(TCCR1B, CS10);
+  for (t = 0; t < 4; t++) {
+    // clock source
+    if (pwmTimersUsed & (1 << t))
+      *pwmTimers[t].tccrb |= pwmClockSelect;
+  }
+
+  pwm_updateInterrupt();
 }
 
-void pwm_inc(enum pwm_output oc, uint16_t step)
+uint32_t pwm_init(uint16_t oc_mask, uint32_t frequency, enum pwm_mode mode)
 {
-  switch(oc) {
-  case PWM_OC1A:
-    if (ocr1a <= PWM_TOP - step) {
-      pwm_setOCR1A(ocr1a + step);
+  uint8_t t, ch;
+  uint8_t channels;
+  const PwmTimerStruct_t *timer;
+  uint8_t sreg = SREG;
+
+  for (t = 0; t < 4; t++) {
+    channels = (oc_mask >> (t*4)) & 0x07;
+    // timer 1 is the reference of the commits, always running
+    if (!channels  &&  t != 0)
+      continue;
+    timer = &pwmTimers[t];
+
+    // init compare match units
+    for (ch = 0; ch < 3; ch++) {
+      if (!(channels & (1 << ch)))
+	continue;
+      // set initial duty cycle to 0
+      pwm_set(1 << (t*4 + ch), 0);
+      // clear on compare match, set at bottom (COMnx: 2; in phase correct
+      // mode clear when up-counting, set when down-counting)
+      *timer->tccra = (*timer->tccra & ~(0x03 << (COM1A0 - 2*ch)))
+	| (0x02 << (COM1A0 - 2*ch));
+      // pin is output
+      *timer->ddr |= (1 << timer->pins[ch]);
     }
-    break;
-  case PWM_OC1B:
-  case PWM_OC1C:
-    // TODO
-    break;
+
+    pwmTimersUsed |= (1 << t);
+  }
+  pwmOutputsUsed |= oc_mask & 0x7777;
+
+  if (frequency > 0  &&  pwm_setFrequency(frequency, mode) > 0)
+    return pwm_getFrequency();
+
+  cli();
+  pwm_configure();
+  SREG = sreg;
+
+  return pwm_getFrequency();
+}
+
+uint32_t pwm_setFrequency(uint32_t frequency, enum pwm_mode mode)
+{
+  uint8_t cs, i;
+  uint32_t top = 0;
+  uint8_t sreg = SREG;
+
+  if (frequency == 0)
+    return 0;
+
+  // smallest prescaler with TOP fitting into 16 bit, i.e., highest resolution
+  for (cs = 0; cs < 5; cs++) {
+    if (mode == PWM_MODE_FAST)
+      top = FOSZ / ((uint32_t)pwmPrescalers[cs] * frequency) - 1;
+    else
+      top = FOSZ / (2UL * pwmPrescalers[cs] * frequency);
+    if (top <= 0xFFFF)
+      break;
   }
+  if (cs == 5  ||  top < 3)
+    return 0; // too low or too high (less than 2 bit resolution)
+
+  cli();
+  pwmTop = top;
+  pwmClockSelect = cs + 1;
+  pwmMode = mode;
+  pwmScale = ((uint32_t)pwmTop * 65536UL + PWM_TOP - 1) / PWM_TOP;
+
+  // rescale the duty cycles, also the ones not applied yet
+  for (i = 0; i < PWM_NUM_OUTPUTS; i++)
+    if (pwmOutputsUsed & (1 << i))
+      *pwm_ocr(1 << i) = pwm_counts(pwmDuty[i]);
+  for (i = 0; i < pwmStaged.numOutputs; i++)
+    pwmStaged.outputs[i].counts = pwm_counts(pwmStaged.outputs[i].value);
+  for (i = 0; i < pwmCommitted.numOutputs; i++)
+    pwmCommitted.outputs[i].counts =
+      pwm_counts(pwmCommitted.outputs[i].value);
+  for (i = 0; i < pwmDelayed.numOutputs; i++)
+    pwmDelayed.outputs[i].counts = pwm_counts(pwmDelayed.outputs[i].value);
+
+  pwm_configure();
+  SREG = sreg;
+
+  return pwm_getFrequency();
+}
+
+uint32_t pwm_getFrequency(void)
+{
+  uint32_t counts = (uint32_t)pwmPrescalers[pwmClockSelect - 1] * pwmTop;
+
+  if (pwmMode == PWM_MODE_FAST)
+    return FOSZ / (counts + pwmPrescalers[pwmClockSelect - 1]);
+  else
+    return FOSZ / (2 * counts);
+}
+
+uint16_t pwm_getResolution(void)
+{
+  return pwmTop;
+}
+
+enum pwm_mode pwm_getMode(void)
+{
+  return pwmMode;
+}
+
+void pwm_inc(enum pwm_output oc, uint16_t step)
+{
+  uint16_t value = pwm_get(oc);
+
+  if (value <= PWM_TOP - step)
+    pwm_set(oc, value + step);
 }
 
 void pwm_dec(enum pwm_output oc, uint16_t step)
 {
-  switch(oc) {
-  case PWM_OC1A:
-    if (ocr1a >= step) {
-      pwm_setOCR1A(ocr1a - step);
-    }
-    break;
-  case PWM_OC1B:
-  case PWM_OC1C:
-    // TODO
-    break;
+  uint16_t value = pwm_get(oc);
+
+  if (value >= step)
+    pwm_set(oc, value - step);
+}
+
+/** Merges pin changes into a list (returns 0 if the list is full). */
+static uint8_t pwm_mergePins(PwmPinsStruct_t *pins, uint8_t *num,
+			     volatile uint8_t *port, uint8_t mask,
+			     uint8_t value)
+{
+  uint8_t i;
+
+  for (i = 0; i < *num; i++)
+    if (pins[i].port == port)
+      break;
+
+  if (i == *num) {
+    if (*num >= PWM_MAX_PORTS)
+      return 0;
+    pins[i].port = port;
+    pins[i].mask = 0;
+    pins[i].value = 0;
+    (*num)++;
   }
+
+  pins[i].mask |= mask;
+  pins[i].value = (pins[i].value & ~mask) | (value & mask);
+
+  return 1;
+}
+
+/** Merges the duty cycle of an output into a set of changes. */
+static void pwm_mergeOutput(PwmStageStruct_t *stage,
+			    const PwmOutputStruct_t *output)
+{
+  uint8_t i;
+
+  for (i = 0; i < stage->numOutputs; i++)
+    if (stage->outputs[i].index == output->index)
+      break;
+  if (i == stage->numOutputs)
+    stage->numOutputs++; // an entry per output at most, fits
+
+  stage->outputs[i] = *output;
+}
+
+void pwm_stageOutput(uint8_t i, volatile uint16_t *ocr, uint16_t value)
+{
+  PwmOutputStruct_t output;
+  uint8_t sreg = SREG;
+
+  output.ocr = ocr;
+  output.index = i;
+  output.value = value;
+
+  cli();
+  output.counts = pwm_counts(value);
+  pwm_mergeOutput(&pwmStaged, &output);
+  SREG = sreg;
+}
+
+int8_t pwm_stagePins(volatile uint8_t *port, uint8_t mask, uint8_t value)
+{
+  int8_t ret;
+  uint8_t sreg = SREG;
+
+  cli();
+  ret = pwm_mergePins(pwmStaged.pins, &pwmStaged.numPins, port, mask, value)
+    ? 0 : -1;
+  SREG = sreg;
+
+  return ret;
+}
+
+int8_t pwm_commit(void)
+{
+  uint8_t i;
+  int8_t ret = 0;
+  uint8_t sreg = SREG;
+
+  cli();
+  // merge into a commit not applied yet
+  for (i = 0; i < pwmStaged.numOutputs; i++)
+    pwm_mergeOutput(&pwmCommitted, &pwmStaged.outputs[i]);
+  for (i = 0; i < pwmStaged.numPins; i++)
+    if (!pwm_mergePins(pwmCommitted.pins, &pwmCommitted.numPins,
+		       pwmStaged.pins[i].port, pwmStaged.pins[i].mask,
+		       pwmStaged.pins[i].value))
+      ret = -1;
+
+  pwmStaged.numOutputs = 0;
+  pwmStaged.numPins = 0;
+  pwmCommitPending = 1;
+  pwm_updateInterrupt();
+  SREG = sreg;
+
+  return ret;
 }
 
-void pwm_set(enum pwm_output oc, uint16_t value)
+uint8_t pwm_committed(void)
 {
-  switch(oc) {
-  case PWM_OC1A:
-    pwm_setOCR1A(value);
-    break;
-  case PWM_OC1B:
-  case PWM_OC1C:
-    // TODO
-    break;
-  } 
+  return !pwmCommitPending  &&  pwmDelayed.numPins == 0;
 }
 
-uint16_t pwm_get(enum pwm_output oc)
+/** Applies commits at the period boundary. */
+static inline void pwm_period(void)
 {
-  switch(oc) {
-  case PWM_OC1A:
-    return ocr1a;
-  case PWM_OC1B:
-  case PWM_OC1C:
-    // TODO
-    break;
+  uint8_t i;
+  PwmOutputStruct_t *output;
+
+  // commit with pins, its outputs are off in this period
+  for (i = 0; i < pwmDelayed.numPins; i++)
+    *pwmDelayed.pins[i].port =
+      (*pwmDelayed.pins[i].port & ~pwmDelayed.pins[i].mask)
+      | pwmDelayed.pins[i].value;
+  for (i = 0; i < pwmDelayed.numOutputs; i++) {
+    output = &pwmDelayed.outputs[i];
+    *output->ocr = output->counts;
+    pwmDuty[output->index] = output->value;
+  }
+  pwmDelayed.numPins = 0;
+  pwmDelayed.numOutputs = 0;
+
+  if (pwmCommitPending) {
+    // buffered by the timers until the next period boundary, outputs
+    // switched off for a period first when pins change
+    for (i = 0; i < pwmCommitted.numOutputs; i++) {
+      output = &pwmCommitted.outputs[i];
+      if (pwmCommitted.numPins) {
+	pwmDelayed.outputs[i] = *output;
+	*output->ocr = 0;
+	pwmDuty[output->index] = 0;
+      } else {
+	*output->ocr = output->counts;
+	pwmDuty[output->index] = output->value;
+      }
+    }
+    for (i = 0; i < pwmCommitted.numPins; i++)
+      pwmDelayed.pins[i] = pwmCommitted.pins[i];
+    if (pwmCommitted.numPins)
+      pwmDelayed.numOutputs = pwmCommitted.numOutputs;
+    pwmDelayed.numPins = pwmCommitted.numPins;
+    pwmCommitted.numOutputs = 0;
+    pwmCommitted.numPins = 0;
+    pwmCommitPending = 0;
   }
 
-  return 0;
+  pwm_updateInterrupt();
+}
+
+// timer 1 overflow, TOV1 is set at TOP = ICR1 (fast PWM mode)
+ISR(TIMER1_OVF_vect)
+{
+  pwm_period();
+}
+
+// timer 1 reached TOP = ICR1 (phase correct mode)
+ISR(TIMER1_CAPT_vect)
+{
+  pwm_period();
 }
@@ -4,114 +4,850 @@
  * @date 06.05.2016
  *
  * @brief Implementation of stepper motor driver.
- * 
- * Driver for a 4-phase unipolar stepper motor (8 wires, 4 connected to
+ *
+ * Driver for 4-phase unipolar stepper motors (8 wires, 4 connected to
  * VCC). Coils are named A1, A2, B1, B2 (see io.h). These pins should be
  * connected to transistors, i.e., '1' should pull the end of a coil to ground.
  *
  * https://learn.adafruit.com/all-about-stepper-motors/types-of-steppers
+ *
+ * Moves are generated by the compare match ISR of timer 3 (CTC mode, 0.5us
+ * per count), which takes a step and sets the interval to the next one. The
+ * interval p follows the real-time approximation of a constant acceleration
+ * by Eiderman (based on Austin, "Generate stepper-motor speed profiles in
+ * real time", 2005):
+ *
+ *   accelerate: p' = p (1 - q),  decelerate: p' = p (1 + q),  q = a p^2 / F^2
+ *
+ * q is updated with the same ratio (q' = q (1 -+ q)^2), so a step needs a
+ * few multiplications only (no division or square root). The first interval
+ * p0 = F / sqrt(2a) gives q0 = 1/2. p is kept in Q16.16, q in Q0.32. The
+ * number of steps accelerated so far equals the number of steps needed to
+ * stop, so deceleration starts when the remaining steps reach it.
+ *
+ * At high speeds (interval below STEPPERMOTOR_INTERVAL_MIN) an interrupt
+ * takes 2^k steps at once (stride), with p and q updated for 2^k steps
+ * (q small, i.e., (1 -+ q)^s ~ 1 -+ s q). So the interrupt rate is bounded
+ * and microsteps reach the same speed as full steps. No axis advances more
+ * than a full step per interrupt (the rotor follows the coils), i.e., the
+ * stride is 1 in full and half step mode.
+ *
+ * The profile is generated for the axis with the most steps of a segment
+ * (major axis). The other axes follow by Bresenham's line algorithm: each
+ * axis adds its steps (times the stride) to an error term, the steps to
+ * take are the error divided by the steps of the major axis. The division
+ * is a binary long division over the bits of the stride (no loop over the
+ * steps), so all axes reach their target in the same interrupt. The ISR
+ * always runs over all axis slots of a segment (unused slots have no steps),
+ * i.e., its duration does not depend on the number of moving axes.
+ *
+ * Each segment starts from rest and stops at its end. The next segment of
+ * the queue starts in the same interrupt, i.e., its first step follows
+ * after p0.
+ *
+ * Homing seeks the edge of an external interrupt input with high speed,
+ * backs off by the steps to stop from this speed and approaches the edge
+ * again slowly. The position is latched in the ISR of the input, i.e., the
+ * exact step count at the edge (the step ISR cannot interrupt it), and the
+ * input stops the move at once.
+ *
+ * In microstep mode the phases A1, A2, B1, B2 (90 degrees apart, as in the
+ * half step sequence) get the current max(0, cos(angle - phase)), i.e.,
+ * two neighbouring phases are on with cos and sin of the angle within the
+ * quadrant. The duty cycles come from a quarter cosine table (PROGMEM),
+ * scaled to the PWM resolution into RAM (again when the resolution changed).
+ * The OCRnx are written in the step ISR, the timers take them over at the
+ * next PWM period. The PWM driver keeps the unscaled values, so a frequency
+ * change rescales the currents of a motor at rest too.
  */
 
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "steppermotor.h"
+#include "dispatch.h"
+#include "extint.h"
+#include "pwm.h"
 #include "io.h"	// port, pins definition
 
+/** Frequency of timer 3 (prescaler 8). */
+#define STEPPERMOTOR_TIMER_FREQ 2000000UL
+/** Maximum interval (Q16.16). */
+#define STEPPERMOTOR_P_MAX      0xFFFF0000UL
+/** Acceleration with p0 = P_MAX (steps/s^2), i.e., F^2 / (2 P_MAX^2). */
+#define STEPPERMOTOR_ACCEL_MIN  466
+/** q0 per acceleration below ACCEL_MIN (Q0.32), i.e., P_MAX^2 / F^2 (also
+ * 2^32 / F^2 per count^2 of the interval in Q0.64). */
+#define STEPPERMOTOR_Q_PER_ACCEL 4611686UL
+/** Minimum interval between two interrupts (counts, i.e., 10 kHz). */
+#define STEPPERMOTOR_INTERVAL_MIN 200
+/** Maximum stride (as power of 2). */
+#define STEPPERMOTOR_STRIDE_MAX 5
+/** Maximum steps of a segment (error term times the stride fits 32 bit). */
+#define STEPPERMOTOR_STEPS_MAX  0x03FFFFFFL
+
 /** Number of steps in full step mode. */
 #define NUM_STEPS_FULL	4
 /** Number of steps in half step mode. */
 #define NUM_STEPS_HALF	8
+/** Microsteps of a quadrant (finest mode, 1/32 step). */
+#define NUM_MICROSTEPS	32
 
-/** Counts steps taken from the beginning. */
-static int32_t csteps = 0;
+/** Quarter cosine (0 .. 90 degrees) of the coil currents (0 .. PWM_TOP). */
+static const uint16_t cosine[NUM_MICROSTEPS + 1] PROGMEM = {
+  800, 799, 796, 791, 785, 776, 766, 753,
+  739, 723, 706, 686, 665, 643, 618, 593,
+  566, 537, 508, 477, 444, 411, 377, 342,
+  306, 270, 232, 194, 156, 117, 78, 39,
+  0
+};
 
-/** Current step in half/full step mode. */
-static volatile uint8_t step = 0;
+/** Duty cycles of the microsteps (counts, same PWM resolution for all
+ * motors). */
+static uint16_t duty[NUM_MICROSTEPS + 1];
+/** PWM resolution of the duty cycles (0 .. not scaled yet). */
+static uint16_t dutyTop = 0;
 
-/** Exciting sequence of coils in full step mode. */
-static uint8_t steps_full[NUM_STEPS_FULL] = {
-  (1<<STEPPERMOTOR_A1 | 1<<STEPPERMOTOR_A2),
-  (1<<STEPPERMOTOR_A2 | 1<<STEPPERMOTOR_B1),
-  (1<<STEPPERMOTOR_B1 | 1<<STEPPERMOTOR_B2),
-  (1<<STEPPERMOTOR_B2 | 1<<STEPPERMOTOR_A1)
-};
+/** Initialized motors. */
+static steppermotor_t *steppermotors[STEPPERMOTOR_MAX_AXES];
+static uint8_t numMotors = 0;
 
-/** Exciting sequence of coils in half step mode. */
-static uint8_t steps_half[NUM_STEPS_HALF] = {
-  (1<<STEPPERMOTOR_A1),
-  (1<<STEPPERMOTOR_A1 | 1<<STEPPERMOTOR_A2),
-  (1<<STEPPERMOTOR_A2),
-  (1<<STEPPERMOTOR_A2 | 1<<STEPPERMOTOR_B1),
-  (1<<STEPPERMOTOR_B1),
-  (1<<STEPPERMOTOR_B1 | 1<<STEPPERMOTOR_B2),
-  (1<<STEPPERMOTOR_B2),
-  (1<<STEPPERMOTOR_B2 | 1<<STEPPERMOTOR_A1)
-};
+/** Linear move of several axes. */
+typedef struct {
+  steppermotor_t *motors[STEPPERMOTOR_MAX_AXES];
+  uint32_t steps[STEPPERMOTOR_MAX_AXES]; // absolute, 0 .. unused slot
+  int8_t dir[STEPPERMOTOR_MAX_AXES]; // 1 .. right, -1 .. left
+  uint32_t major; // steps of the major axis
+  uint32_t p0, q0; // start
+  uint32_t pmin; // interval at maximum speed (Q16.16)
+  uint8_t strideMax; // of all moving axes (as power of 2)
+} SteppermotorSegment_t;
+
+/** Queued segments, the running one at the tail. */
+static volatile SteppermotorSegment_t queue[STEPPERMOTOR_QUEUE_SIZE];
+static volatile uint8_t queueHead = 0; // next write (free running)
+static volatile uint8_t queueTail = 0; // running or next (free running)
+
+/** Running segment generated by timer 3. */
+static volatile struct {
+  uint32_t error[STEPPERMOTOR_MAX_AXES]; // Bresenham, 0 .. major - 1
+  uint32_t left; // steps of the major axis left
+  uint32_t p; // interval (Q16.16)
+  uint32_t q; // a p^2 / F^2 (Q0.32)
+  uint32_t n; // steps accelerated, i.e., to stop
+  uint8_t shift; // stride of the next interrupt (as power of 2)
+  uint8_t stopping;
+  uint8_t moving;
+} move;
 
-static uint8_t *steps = steps_full;
-static uint8_t num_steps = NUM_STEPS_FULL;
+/** Event of the completion callback (-1 .. none). */
+static int8_t moveEvent = -1;
 
-void steppermotor_init(enum steppermotor_mode mode)
+/** Adds a motor to the initialized ones (once) and sets up timer 3 with the
+ * first motor. Returns -1 if there are too many motors. */
+static int8_t steppermotor_register(steppermotor_t *motor)
 {
-  // init pins
-  // value
-  CLEAR_BIT(STEPPERMOTOR_PORT, STEPPERMOTOR_A1);
-  CLEAR_BIT(STEPPERMOTOR_PORT, STEPPERMOTOR_A2);
-  CLEAR_BIT(STEPPERMOTOR_PORT, STEPPERMOTOR_B1);
-  CLEAR_BIT(STEPPERMOTOR_PORT, STEPPERMOTOR_B2);
-  // direction
-  SET_BIT(STEPPERMOTOR_DDR, STEPPERMOTOR_A1);
-  SET_BIT(STEPPERMOTOR_DDR, STEPPERMOTOR_A2);
-  SET_BIT(STEPPERMOTOR_DDR, STEPPERMOTOR_B1);
-  SET_BIT(STEPPERMOTOR_DDR, STEPPERMOTOR_B2);
+  uint8_t i;
 
-  // init variables
-  step = 0; // goes from 0 to num_steps
+  for (i = 0; i < numMotors; i++)
+    if (steppermotors[i] == motor)
+      return 0; // initialized again
+  if (numMotors == STEPPERMOTOR_MAX_AXES)
+    return -1;
+
+  if (numMotors == 0) {
+    // timer 3 in CTC mode with top OCR3A, stopped
+    TIMSK3 &= ~(1 << OCIE3A);
+    TCCR3A = 0x00;
+    TCCR3B = (1 << WGM32);
+    move.moving = 0;
+  }
+  steppermotors[numMotors++] = motor;
+
+  return 0;
+}
+
+int8_t steppermotor_init(steppermotor_t *motor, volatile uint8_t *port,
+			 volatile uint8_t *ddr, uint8_t a1, uint8_t a2,
+			 uint8_t b1, uint8_t b2, enum steppermotor_mode mode)
+{
+  uint8_t i;
 
+  if (steppermotor_register(motor))
+    return -1;
+
+  motor->port = port;
+  motor->mask = (1<<a1 | 1<<a2 | 1<<b1 | 1<<b2);
+  motor->micro = 0;
+
+  // init pins
+  *port &= ~motor->mask; // value
+  *ddr |= motor->mask; // direction
+
+  // exciting sequence of coils
   if (mode == HALF) {
-    steps = steps_half;
-    num_steps = NUM_STEPS_HALF;
+    motor->patterns[0] = (1<<a1);
+    motor->patterns[1] = (1<<a1 | 1<<a2);
+    motor->patterns[2] = (1<<a2);
+    motor->patterns[3] = (1<<a2 | 1<<b1);
+    motor->patterns[4] = (1<<b1);
+    motor->patterns[5] = (1<<b1 | 1<<b2);
+    motor->patterns[6] = (1<<b2);
+    motor->patterns[7] = (1<<b2 | 1<<a1);
+    motor->numSteps = NUM_STEPS_HALF;
   } else {
-    steps = steps_full;
-    num_steps = NUM_STEPS_FULL;
+    motor->patterns[0] = (1<<a1 | 1<<a2);
+    motor->patterns[1] = (1<<a2 | 1<<b1);
+    motor->patterns[2] = (1<<b1 | 1<<b2);
+    motor->patterns[3] = (1<<b2 | 1<<a1);
+    for (i = NUM_STEPS_FULL; i < NUM_STEPS_HALF; i++)
+      motor->patterns[i] = 0;
+    motor->numSteps = NUM_STEPS_FULL;
   }
+  motor->strideMax = 0; // skipped patterns are not followed
+
+  // init variables
+  motor->step = 0; // goes from 0 to numSteps
+  motor->position = 0;
+  motor->planned = 0;
+  motor->homed = 0;
+
+  return 0;
+}
+
+/** Scales the duty cycles of the microsteps to the PWM resolution. */
+static void steppermotor_scale(void)
+{
+  uint8_t i;
+
+  dutyTop = pwm_getResolution();
+  for (i = 0; i <= NUM_MICROSTEPS; i++)
+    duty[i] = ((uint32_t)pgm_read_word(&cosine[i]) * dutyTop + PWM_TOP/2)
+      / PWM_TOP;
+}
+
+int8_t steppermotor_initMicro(steppermotor_t *motor, enum pwm_output a1,
+			      enum pwm_output a2, enum pwm_output b1,
+			      enum pwm_output b2, enum steppermotor_mode mode)
+{
+  if (mode < MICRO8  ||  mode > MICRO32)
+    return -1;
+  if (steppermotor_register(motor))
+    return -1;
+
+  pwm_init(a1 | a2 | b1 | b2, 0, PWM_MODE_FAST);
+  motor->coils[0] = pwm_ocr(a1);
+  motor->coils[1] = pwm_ocr(a2);
+  motor->coils[2] = pwm_ocr(b1);
+  motor->coils[3] = pwm_ocr(b2);
+  motor->outputs[0] = pwm_index(a1);
+  motor->outputs[1] = pwm_index(a2);
+  motor->outputs[2] = pwm_index(b1);
+  motor->outputs[3] = pwm_index(b2);
+  motor->port = 0;
+  motor->mask = 0;
+
+  steppermotor_scale();
+
+  // 4 quadrants with 8, 16 or 32 microsteps
+  motor->micro = 1;
+  motor->microShift = MICRO32 - mode;
+  motor->numSteps = 4 * (NUM_MICROSTEPS >> motor->microShift);
+  // a full step per interrupt at most
+  motor->strideMax = 0;
+  while ((4 << motor->strideMax) < motor->numSteps)
+    motor->strideMax++;
+
+  // init variables
+  motor->step = 0;
+  motor->position = 0;
+  motor->planned = 0;
+  motor->homed = 0;
+
+  return 0;
+}
+
+/** Takes steps (negative .. left), interrupts must be disabled if a move
+ * is running. */
+static inline void steppermotor_advance(steppermotor_t *motor, int8_t delta)
+{
+  motor->step = (motor->step + delta) & (motor->numSteps - 1);
+  motor->position += delta;
+
+  // apply step
+  steppermotor_on(motor);
 }
 
-void steppermotor_step(enum steppermotor_direction dir)
+void steppermotor_step(steppermotor_t *motor, enum steppermotor_direction dir)
 {
   // increase or decrease step
-  if (dir == RIGHT) {
-    step = (step + 1) % num_steps;
-    csteps++;
-  } else if (dir == LEFT) {
-    if (step == 0)
-      step = num_steps - 1;
-    else
-      step--;
-    csteps--;
+  if (dir == RIGHT)
+    steppermotor_advance(motor, 1);
+  else if (dir == LEFT)
+    steppermotor_advance(motor, -1);
+  motor->planned = motor->position;
+}
+
+/** Sets the current of a coil to an entry of the cosine table. */
+static inline void steppermotor_coil(steppermotor_t *motor, uint8_t coil,
+				     uint8_t index)
+{
+  pwm_setScaled(motor->outputs[coil], motor->coils[coil],
+		pgm_read_word(&cosine[index]), duty[index]);
+}
+
+void steppermotor_on(steppermotor_t *motor)
+{
+  uint8_t index, quadrant;
+
+  if (motor->micro) {
+    if (pwm_getResolution() != dutyTop)
+      steppermotor_scale(); // PWM frequency changed
+    // angle in 1/32 steps, two phases on
+    index = (motor->step << motor->microShift) & (NUM_MICROSTEPS - 1);
+    quadrant = (motor->step << motor->microShift) / NUM_MICROSTEPS;
+    steppermotor_coil(motor, quadrant, index);
+    steppermotor_coil(motor, (quadrant + 1) & 0x03, NUM_MICROSTEPS - index);
+    steppermotor_coil(motor, (quadrant + 2) & 0x03, NUM_MICROSTEPS);
+    steppermotor_coil(motor, (quadrant + 3) & 0x03, NUM_MICROSTEPS);
+    return;
   }
 
-  // apply step
-  steppermotor_on();
+  // clear and set pins
+  *motor->port = (*motor->port & ~motor->mask) | motor->patterns[motor->step];
+}
+
+void steppermotor_off(steppermotor_t *motor)
+{
+  uint8_t i;
+
+  if (motor->micro) {
+    for (i = 0; i < 4; i++)
+      pwm_setScaled(motor->outputs[i], motor->coils[i], 0, 0);
+    return;
+  }
+
+  *motor->port &= ~motor->mask;
+}
+
+int32_t steppermotor_position(steppermotor_t *motor)
+{
+  int32_t position;
+  uint8_t sreg = SREG;
+
+  cli(); // updated by the ISR of a move
+  position = motor->position;
+  SREG = sreg;
+
+  return position;
+}
+
+void steppermotor_snapshot(uint8_t num, steppermotor_t * const *motors,
+			   int32_t *positions)
+{
+  uint8_t i;
+  uint8_t sreg = SREG;
+
+  cli(); // no step interrupt in between
+  for (i = 0; i < num; i++)
+    positions[i] = motors[i]->position;
+  SREG = sreg;
+}
+
+/** Returns the high 32 bits of the product (a * b >> 32), with 16x16 bit
+ * multiplications. */
+static inline uint32_t steppermotor_mul(uint32_t a, uint32_t b)
+{
+  uint16_t ah = a >> 16, al = a, bh = b >> 16, bl = b;
+
+  return (uint32_t)ah * bh + (((uint32_t)ah * bl) >> 16)
+    + (((uint32_t)al * bh) >> 16);
+}
+
+/** Returns the integer square root. */
+static uint16_t steppermotor_sqrt(uint32_t x)
+{
+  uint32_t root = 0, bit = 1UL << 30;
+
+  while (bit > x)
+    bit >>= 2;
+  while (bit != 0) {
+    if (x >= root + bit) {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    } else
+      root >>= 1;
+    bit >>= 2;
+  }
+
+  return root;
+}
+
+/** Starts the segment at the tail of the queue, first step after p0
+ * (interrupts must be disabled). */
+static void steppermotor_start(void)
+{
+  volatile SteppermotorSegment_t *seg = &queue[queueTail
+					       % STEPPERMOTOR_QUEUE_SIZE];
+  uint8_t i;
+
+  for (i = 0; i < STEPPERMOTOR_MAX_AXES; i++)
+    move.error[i] = seg->major / 2;
+  move.left = seg->major;
+  move.p = seg->p0;
+  move.q = seg->q0;
+  move.n = 0;
+  move.shift = 0;
+  OCR3A = (move.p >> 16) - 1;
+}
+
+/** Interval of the first step and at maximum speed of segments. */
+typedef struct {
+  uint32_t p0, q0;
+  uint32_t pmin;
+} SteppermotorProfile_t;
+
+/** Calculates a speed profile (sqrt, division once per segment). Returns -1
+ * on invalid parameters. */
+static int8_t steppermotor_profile(SteppermotorProfile_t *profile,
+				   uint16_t maxSpeed, uint32_t accel)
+{
+  uint32_t q;
+
+  if (maxSpeed < STEPPERMOTOR_SPEED_MIN  ||  maxSpeed > STEPPERMOTOR_SPEED_MAX
+      ||  accel == 0)
+    return -1;
+
+  // first interval and q
+  if (accel >= STEPPERMOTOR_ACCEL_MIN) {
+    profile->p0 = (uint32_t)steppermotor_sqrt(2000000000UL / accel * 1000UL)
+      << 16;
+    profile->q0 = 0x80000000UL;
+  } else {
+    profile->p0 = STEPPERMOTOR_P_MAX;
+    profile->q0 = accel * STEPPERMOTOR_Q_PER_ACCEL;
+  }
+  profile->pmin = ((STEPPERMOTOR_TIMER_FREQ / maxSpeed) << 16)
+    | (((STEPPERMOTOR_TIMER_FREQ % maxSpeed) << 16) / maxSpeed);
+  if (profile->p0 < profile->pmin) {
+    // maximum speed below the first interval, q of pmin (a p^2 / F^2,
+    // saturated at 1, the move does not accelerate anyway)
+    profile->p0 = profile->pmin;
+    q = steppermotor_mul((profile->p0 >> 16) * (profile->p0 >> 16),
+			 STEPPERMOTOR_Q_PER_ACCEL);
+    profile->q0 = (q > 0xFFFFFFFFUL / accel) ? 0xFFFFFFFFUL : q * accel;
+  }
+
+  return 0;
+}
+
+/** Queues a segment and starts timer 3 if idle (may be called from an
+ * ISR). Returns -1 if the queue is full or while stopping. */
+static int8_t steppermotor_queue(uint8_t num, steppermotor_t * const *motors,
+				 const int32_t *positions,
+				 const SteppermotorProfile_t *profile)
+{
+  volatile SteppermotorSegment_t *seg;
+  uint32_t major = 0;
+  int32_t delta;
+  uint8_t i;
+  uint8_t sreg = SREG;
+
+  cli();
+  if (move.stopping
+      ||  (uint8_t)(queueHead - queueTail) >= STEPPERMOTOR_QUEUE_SIZE) {
+    SREG = sreg;
+    return -1;
+  }
+
+  // steps of the axes from the end of the queued segments
+  seg = &queue[queueHead % STEPPERMOTOR_QUEUE_SIZE];
+  seg->strideMax = STEPPERMOTOR_STRIDE_MAX;
+  for (i = 0; i < STEPPERMOTOR_MAX_AXES; i++) {
+    seg->steps[i] = 0;
+    if (i >= num)
+      continue;
+    delta = positions[i] - motors[i]->planned;
+    seg->motors[i] = motors[i];
+    seg->dir[i] = (delta >= 0) ? 1 : -1;
+    seg->steps[i] = (delta >= 0) ? delta : -delta;
+    if (seg->steps[i] > major)
+      major = seg->steps[i];
+    if (seg->steps[i] > 0  &&  motors[i]->strideMax < seg->strideMax)
+      seg->strideMax = motors[i]->strideMax;
+  }
+  if (major > STEPPERMOTOR_STEPS_MAX) {
+    SREG = sreg;
+    return -1;
+  }
+
+  if (major == 0) {
+    if (!move.moving  &&  moveEvent >= 0)
+      dispatch_post(moveEvent); // already there
+  } else {
+    seg->major = major;
+    seg->pmin = profile->pmin;
+    seg->p0 = profile->p0;
+    seg->q0 = profile->q0;
+    for (i = 0; i < num; i++)
+      motors[i]->planned = positions[i];
+    queueHead++;
+
+    if (!move.moving) {
+      steppermotor_start();
+      move.moving = 1;
+      // start timer 3
+      TCNT3 = 0;
+      TIFR3 = (1 << OCF3A); // clear pending interrupt (by writing a one)
+      TIMSK3 |= (1 << OCIE3A);
+      TCCR3B |= (1 << CS31); // prescaler 8
+    }
+  }
+  SREG = sreg;
+
+  return 0;
+}
+
+/** Decelerates the running segment and clears the queue (may be called
+ * from an ISR). */
+static void steppermotor_halt(void)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  if (move.moving) {
+    move.stopping = 1;
+    queueHead = queueTail + 1; // running segment only
+  }
+  SREG = sreg;
+}
+
+/** Homing states. */
+enum steppermotor_homing {
+  HOMING_IDLE = 0,
+  HOMING_SEEK, // fast to the edge
+  HOMING_BACKOFF, // back before the edge
+  HOMING_APPROACH // slow to the edge
+};
+
+/** Homing of a motor, one at a time. */
+static struct {
+  steppermotor_t *motor;
+  volatile uint8_t state;
+  int8_t no; // external interrupt
+  int8_t dir; // 1 .. right, -1 .. left
+  volatile uint8_t latched;
+  volatile int32_t latch; // position at the edge
+  uint32_t margin; // steps to stop from fast speed
+  SteppermotorProfile_t fast, slow;
+} homing;
+
+/** Edge of the home input, latches the position and stops (external
+ * interrupt, i.e., no step in between). */
+static void steppermotor_homeEdge(void)
+{
+  if (homing.state != HOMING_SEEK  &&  homing.state != HOMING_APPROACH)
+    return;
+  if (homing.latched)
+    return;
+
+  homing.latch = homing.motor->position;
+  homing.latched = 1;
+  extint_disable(homing.no);
+  steppermotor_halt();
+}
+
+/** Moves the homed motor to a position (interrupts must be disabled).
+ * Returns 0 if the move started. */
+static int8_t steppermotor_homeMove(int32_t position,
+				    const SteppermotorProfile_t *profile)
+{
+  steppermotor_t *motor = homing.motor;
+
+  steppermotor_queue(1, &motor, &position, profile);
+
+  return move.moving ? 0 : -1;
+}
+
+/** Continues homing after a move (interrupts must be disabled). Returns 1
+ * if homing continues with another move. */
+static uint8_t steppermotor_homeNext(void)
+{
+  steppermotor_t *motor = homing.motor;
+  int32_t offset = homing.dir * (int32_t)homing.margin;
+
+  switch (homing.state) {
+  case HOMING_SEEK:
+    if (!homing.latched)
+      break; // no edge within distance
+    homing.state = HOMING_BACKOFF;
+    if (steppermotor_homeMove(homing.latch - offset, &homing.fast) == 0)
+      return 1;
+    break;
+  case HOMING_BACKOFF:
+    homing.state = HOMING_APPROACH;
+    homing.latched = 0;
+    extint_enable(homing.no); // discards edges while backing off
+    if (steppermotor_homeMove(homing.latch + offset, &homing.slow) == 0)
+      return 1;
+    break;
+  case HOMING_APPROACH:
+    if (!homing.latched)
+      break;
+    // edge is the new origin
+    motor->position -= homing.latch;
+    motor->planned = motor->position;
+    motor->homed = 1;
+    break;
+  default:
+    return 0;
+  }
+
+  extint_releaseInt(homing.no);
+  homing.state = HOMING_IDLE;
+
+  return 0;
+}
+
+/** Stops timer 3 and notifies (interrupts must be disabled). */
+static void steppermotor_finish(void)
+{
+  uint8_t i;
+
+  TIMSK3 &= ~(1 << OCIE3A);
+  TCCR3B &= ~((1 << CS32) | (1 << CS31) | (1 << CS30));
+  if (move.stopping) {
+    // stopped before the targets
+    for (i = 0; i < numMotors; i++)
+      steppermotors[i]->planned = steppermotors[i]->position;
+  }
+  move.moving = 0;
+  move.stopping = 0;
+  if (steppermotor_homeNext())
+    return; // notify at the end of homing
+  if (moveEvent >= 0)
+    dispatch_post(moveEvent); // call in main loop
+}
+
+/** Removes the running segment and starts the next one, if any (interrupts
+ * must be disabled). */
+static void steppermotor_next(void)
+{
+  queueTail++;
+  if (!move.stopping  &&  queueTail != queueHead)
+    steppermotor_start();
+  else
+    steppermotor_finish();
+}
+
+int8_t steppermotor_moveLinear(uint8_t num, steppermotor_t * const *motors,
+			       const int32_t *positions, uint16_t maxSpeed,
+			       uint32_t accel)
+{
+  SteppermotorProfile_t profile;
+
+  if (num == 0  ||  num > STEPPERMOTOR_MAX_AXES
+      ||  steppermotor_profile(&profile, maxSpeed, accel))
+    return -1;
+  if (homing.state != HOMING_IDLE)
+    return -1;
+
+  return steppermotor_queue(num, motors, positions, &profile);
+}
+
+int8_t steppermotor_moveTo(steppermotor_t *motor, int32_t position,
+			   uint16_t maxSpeed, uint32_t accel)
+{
+  return steppermotor_moveLinear(1, &motor, &position, maxSpeed, accel);
+}
+
+int8_t steppermotor_home(steppermotor_t *motor, int8_t no, uint8_t trigger,
+			 int32_t distance, uint16_t speed, uint16_t slowSpeed,
+			 uint32_t accel)
+{
+  SteppermotorProfile_t fast, slow;
+  uint8_t active, sreg;
+  int8_t ret;
+
+  if (distance == 0  ||  trigger == EXTINT_TRIGGER_LOW_LEVEL
+      ||  steppermotor_profile(&fast, speed, accel)
+      ||  steppermotor_profile(&slow, slowSpeed, accel))
+    return -1;
+  if (move.moving  ||  homing.state != HOMING_IDLE)
+    return -1;
+  if (extint_requestInt(no, trigger, steppermotor_homeEdge) < 0)
+    return -1;
+
+  // input at the edge already, i.e., pressed limit switch?
+  if (trigger == EXTINT_TRIGGER_FALLING_EDGE)
+    active = !extint_getLevel(no);
+  else if (trigger == EXTINT_TRIGGER_RISING_EDGE)
+    active = extint_getLevel(no);
+  else
+    active = 0;
+
+  sreg = SREG;
+  cli();
+  homing.motor = motor;
+  homing.fast = fast;
+  homing.slow = slow;
+  homing.no = no;
+  homing.dir = (distance > 0) ? 1 : -1;
+  homing.margin = (uint32_t)speed * speed / (2 * accel) + 1;
+  homing.latched = 0;
+  motor->homed = 0;
+  if (active) {
+    // back off first
+    homing.latch = motor->position;
+    homing.state = HOMING_BACKOFF;
+    extint_disable(no);
+    ret = steppermotor_homeMove(homing.latch
+				- homing.dir * (int32_t)homing.margin,
+				&homing.fast);
+  } else {
+    homing.state = HOMING_SEEK;
+    ret = steppermotor_homeMove(motor->planned + distance, &homing.fast);
+  }
+  if (ret) {
+    homing.state = HOMING_IDLE;
+    extint_releaseInt(no);
+  }
+  SREG = sreg;
+
+  return ret;
+}
+
+uint8_t steppermotor_homed(steppermotor_t *motor)
+{
+  return motor->homed;
 }
 
-void steppermotor_on(void)
+void steppermotor_stop(void)
 {
-  // read port
-  uint8_t cur = STEPPERMOTOR_PORT;
-  // clear pins
-  cur &= ~(1<<STEPPERMOTOR_A1 | 1<<STEPPERMOTOR_A2 | 1<<STEPPERMOTOR_B1 | 1<<STEPPERMOTOR_B2);
-  // set pins
-  cur |= steps[step];
+  uint8_t sreg = SREG;
 
-  // assign to port
-  STEPPERMOTOR_PORT = cur;
+  cli();
+  if (homing.state != HOMING_IDLE) {
+    // abort homing
+    homing.state = HOMING_IDLE;
+    extint_releaseInt(homing.no);
+  }
+  steppermotor_halt();
+  SREG = sreg;
+}
+
+uint8_t steppermotor_moving(void)
+{
+  return move.moving;
 }
 
-void steppermotor_off(void)
+uint8_t steppermotor_queueFree(void)
 {
-  STEPPERMOTOR_PORT &= ~(1<<STEPPERMOTOR_A1 | 1<<STEPPERMOTOR_A2 | 1<<STEPPERMOTOR_B1 | 1<<STEPPERMOTOR_B2);
+  uint8_t used;
+  uint8_t sreg = SREG;
+
+  cli();
+  used = queueHead - queueTail;
+  SREG = sreg;
+
+  return STEPPERMOTOR_QUEUE_SIZE - used;
 }
 
-int32_t steppermotor_position(void)
+int8_t steppermotor_setCallback(uint8_t priority, void (*callback)(void))
 {
-  return csteps;
+  int8_t event = -1;
+
+  if (callback) {
+    event = dispatch_request(priority, callback);
+    if (event < 0)
+      return -1;
+  }
+
+  dispatch_release(moveEvent);
+  moveEvent = event;
+
+  return 0;
+}
+
+// timer 3 compare match, time for the next step(s)
+ISR(TIMER3_COMPA_vect)
+{
+  volatile SteppermotorSegment_t *seg = &queue[queueTail
+					       % STEPPERMOTOR_QUEUE_SIZE];
+  int32_t remaining;
+  uint32_t t, sq, error, d;
+  uint8_t i, j, k;
+  uint8_t stride = 1 << move.shift;
+
+  // steps of each axis within the stride (Bresenham), quotient of the
+  // error and the major steps bit by bit
+  for (i = 0; i < STEPPERMOTOR_MAX_AXES; i++) {
+    error = move.error[i] + (seg->steps[i] << move.shift);
+    d = seg->major << move.shift;
+    k = 0;
+    for (j = 0; j <= move.shift; j++) {
+      k <<= 1;
+      if (error >= d) {
+	error -= d;
+	k |= 1;
+      }
+      d >>= 1;
+    }
+    move.error[i] = error;
+    if (k)
+      steppermotor_advance(seg->motors[i], seg->dir[i] > 0 ? k : -k);
+  }
+
+  // steps left of the major axis
+  move.left -= stride;
+  if (move.left == 0) {
+    steppermotor_next();
+    return;
+  }
+  remaining = move.left;
+  if (move.stopping  &&  remaining > (int32_t)move.n)
+    remaining = move.n;
+
+  // q of the stride
+  sq = move.q << move.shift;
+
+  if ((remaining <= (int32_t)move.n  ||  move.p < seg->pmin)
+      &&  move.n > stride) {
+    // decelerate
+    t = move.q + steppermotor_mul(move.q, sq);
+    move.p += steppermotor_mul(move.p, sq);
+    if (move.p > STEPPERMOTOR_P_MAX)
+      move.p = STEPPERMOTOR_P_MAX;
+    move.q = t + steppermotor_mul(t, sq);
+    move.n -= stride;
+  } else if (remaining <= (int32_t)move.n) {
+    // (almost) stopped before the end, stop or start again
+    if (move.stopping) {
+      steppermotor_next();
+      return;
+    }
+    move.p = seg->p0;
+    move.q = seg->q0;
+    move.n = 0;
+  } else if (move.p > seg->pmin) {
+    // accelerate
+    t = move.q - steppermotor_mul(move.q, sq);
+    move.p -= steppermotor_mul(move.p, sq);
+    if (move.p < seg->pmin)
+      move.p = seg->pmin;
+    move.q = t - steppermotor_mul(t, sq);
+    move.n += stride;
+  }
+  // else cruise
+
+  // stride of the next interrupt, not beyond the end or the steps to stop
+  move.shift = 0;
+  stride = 1;
+  while (move.shift < seg->strideMax
+	 &&  ((move.p >> 16) << move.shift) < STEPPERMOTOR_INTERVAL_MIN
+	 &&  remaining >= 4 * (int32_t)stride  &&  move.n >= 2UL * stride) {
+    move.shift++;
+    stride <<= 1;
+  }
+
+  OCR3A = ((move.p >> 16) << move.shift) - 1;
 }
@@ -7,30 +7,72 @@
  */
 
 #include <avr/interrupt.h>
+#include <stddef.h>	// NULL
+#include <string.h>	// memcpy
 #include "uart0.h"
+#include "io.h"	// FOSZ
 
-// baudrate register values from datasheet:
-#define UBRRH_9600	0
-#define UBRRL_9600	207
-#define UBRRH_19200	0
-#define UBRRL_19200	103	
-#define UBRRH_57600	0
-#define UBRRL_57600	34	
-#define UBRRH_115200	0
-#define UBRRL_115200	16
+// baudrate register value in double speed mode (rounded)
+#define UART0_UBRR(baud)	((FOSZ + 4UL*(baud)) / (8UL*(baud)) - 1)
 
-static volatile uint8_t uart0_receive_flag = 0;
-static volatile char uart0_receive_data;
+/** Baudrate register values (same order as enum uart0_baud). */
+static const uint16_t uart0_ubrr[UART0_BAUD_NUM] = {
+  UART0_UBRR(9600),	// 207
+  UART0_UBRR(19200),	// 103
+  UART0_UBRR(57600),	// 34
+  UART0_UBRR(115200),	// 16
+  UART0_UBRR(500000),	// 3
+  UART0_UBRR(1000000),	// 1
+  UART0_UBRR(2000000)	// 0
+};
 
-void uart0_init()
+static enum uart0_baud uart0_baud = UART0_BAUD_115200;
+
+#define UART0_TX_MASK	(UART0_TX_SIZE - 1)
+#define UART0_RX_MASK	(UART0_RX_SIZE - 1)
+#define UART0_RX_FRAMES_MASK	(UART0_RX_FRAMES - 1)
+
+// receive buffer, bytes from tail to head are received (free-running indices)
+static volatile char uart0_rx_buffer[UART0_RX_SIZE];
+static volatile uint8_t uart0_rx_head = 0;	// written by ISR
+static volatile uint8_t uart0_rx_tail = 0;	// written by uart0_getc
+static volatile uint16_t uart0_rx_overruns = 0;
+static volatile uint16_t uart0_rx_hw_overruns = 0;
+
+// frame assembler: the ISR replaces the delimiter with '\0' and saves the
+// index of the terminator of each complete frame
+static volatile uint8_t uart0_frames = 0;	// 1 .. enabled
+static volatile char uart0_frame_delimiter;
+static volatile uint8_t uart0_frame_end[UART0_RX_FRAMES];
+static volatile uint8_t uart0_frame_head = 0;	// written by ISR
+static volatile uint8_t uart0_frame_tail = 0;	// written by uart0_releaseFrame
+static uint8_t uart0_frame_start = 0;	// start of frame currently received
+static uint8_t uart0_frame_discard = 0;	// 1 .. skip bytes until delimiter
+// copy of a frame wrapping around the end of the receive buffer
+static char uart0_frame_copy[UART0_RX_SIZE];
+
+// transmit buffer, bytes from tail to head are pending (free-running indices)
+static volatile char uart0_tx_buffer[UART0_TX_SIZE];
+static volatile uint8_t uart0_tx_head = 0;	// written by uart0_putc
+static volatile uint8_t uart0_tx_tail = 0;	// written by ISR
+static enum uart0_txpolicy uart0_tx_policy = UART0_TX_BLOCK;
+static uint16_t uart0_tx_dropped = 0;
+static uint8_t uart0_tx_highwater = 0;
+static volatile uint8_t uart0_tx_written = 0;	// 1 .. TXC0 is meaningful
+
+void uart0_init(enum uart0_baud baud)
 {
+  if (baud >= UART0_BAUD_NUM)
+    baud = UART0_BAUD_115200;
+
   cli();
 
   // pin operations of Tx and Rx are overriden when UART enabled
 
   // set baud rate
-  UBRR0H = UBRRH_115200;
-  UBRR0L = UBRRL_115200;
+  uart0_baud = baud;
+  UBRR0H = uart0_ubrr[baud] >> 8;
+  UBRR0L = uart0_ubrr[baud] & 0xFF;
 
   // double speed, buffer ready to be written
   UCSR0A |= (1<<U2X0) | (1<<UDRE0);
@@ -48,11 +90,112 @@ void uart0_init()
   sei();
 }
 
+void uart0_flush(void)
+{
+  if (!uart0_tx_written)
+    return; // nothing sent yet
+
+  // wait until the buffer is empty and the last byte is shifted out
+  while (uart0_tx_head != uart0_tx_tail);
+  while (!(UCSR0A & (1<<TXC0)));
+}
+
+void uart0_setBaud(enum uart0_baud baud)
+{
+  if (baud >= UART0_BAUD_NUM)
+    return;
+
+  uart0_flush();
+
+  // writing the low byte updates the baud rate prescaler
+  uart0_baud = baud;
+  UBRR0H = uart0_ubrr[baud] >> 8;
+  UBRR0L = uart0_ubrr[baud] & 0xFF;
+}
+
+enum uart0_baud uart0_getBaud(void)
+{
+  return uart0_baud;
+}
+
+/** Writes the data register and clears the transmit complete flag. */
+static inline void uart0_write(char data)
+{
+  UDR0 = data;
+  // TXC0 is cleared by writing 1, keep double speed
+  UCSR0A = (UCSR0A & (1<<U2X0)) | (1<<TXC0);
+  uart0_tx_written = 1;
+}
+
+void uart0_setTxPolicy(enum uart0_txpolicy policy)
+{
+  uart0_tx_policy = policy;
+}
+
+uint16_t uart0_txDropped(void)
+{
+  uint16_t dropped;
+  uint8_t sreg = SREG;
+
+  cli();
+  dropped = uart0_tx_dropped;
+  SREG = sreg;
+
+  return dropped;
+}
+
+uint8_t uart0_txHighWater(void)
+{
+  return uart0_tx_highwater;
+}
+
 void uart0_putc(char myData)
 {
-  // wait for empty transmit buffer
-  while ( !( UCSR0A & (1<<UDRE0)) );
-  UDR0 = myData;
+  uint8_t sreg = SREG;
+  uint8_t used;
+
+  cli();
+  used = uart0_tx_head - uart0_tx_tail;
+
+  // transmit buffer full?
+  while (used >= UART0_TX_SIZE) {
+    switch (uart0_tx_policy) {
+    case UART0_TX_DROP:
+      uart0_tx_dropped++;
+      SREG = sreg;
+      return;
+    case UART0_TX_OVERWRITE:
+      uart0_tx_tail++; // discard oldest byte
+      uart0_tx_dropped++;
+      break;
+    case UART0_TX_BLOCK:
+    default:
+      if (sreg & (1<<SREG_I)) {
+	// wait for the ISR to send a byte
+	SREG = sreg;
+	while ((uint8_t)(uart0_tx_head - uart0_tx_tail) >= UART0_TX_SIZE);
+	cli();
+      } else {
+	// interrupts disabled (e.g., called from an ISR), send oldest byte
+	while ( !( UCSR0A & (1<<UDRE0)) );
+	uart0_write(uart0_tx_buffer[uart0_tx_tail & UART0_TX_MASK]);
+	uart0_tx_tail++;
+      }
+      break;
+    }
+    used = uart0_tx_head - uart0_tx_tail;
+  }
+
+  uart0_tx_buffer[uart0_tx_head & UART0_TX_MASK] = myData;
+  uart0_tx_head++;
+  used++;
+  if (used > uart0_tx_highwater)
+    uart0_tx_highwater = used;
+
+  // start transmission (data register empty interrupt)
+  UCSR0B |= (1<<UDRIE0);
+
+  SREG = sreg;
 }
 
 void uart0_print(char* string)
@@ -74,12 +217,71 @@ void uart0_println(char* string)
   uart0_putc('\r');
 }
 
+void uart0_print_P(PGM_P string)
+{
+  char c;
+
+  while ((c = pgm_read_byte(string)) != '\0') {
+    uart0_putc(c);
+    string++;
+  }
+}
+
+void uart0_println_P(PGM_P string)
+{
+  uart0_print_P(string);
+
+  uart0_putc('\n');
+  uart0_putc('\r');
+}
+
+/** Powers of 10 for the decimal conversion (by subtraction). */
+static const uint32_t uart0_pow10[10] PROGMEM = {
+  1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+  10000UL, 1000UL, 100UL, 10UL, 1UL
+};
+
+void uart0_printDec(uint32_t value, uint8_t digits, uint8_t flags)
+{
+  uint8_t i, digit;
+  uint8_t leading = 1; // still in leading zeros
+  uint32_t power;
+
+  for (i = 0; i < 10; i++) {
+    power = pgm_read_dword(&uart0_pow10[i]);
+
+    // count how often the power fits (max. 9 subtractions, no division)
+    digit = '0';
+    while (value >= power) {
+      value -= power;
+      digit++;
+    }
+
+    if (digit != '0'  ||  i == 9)
+      leading = 0;
+
+    if (!leading)
+      uart0_putc(digit);
+    else if (i >= 10 - digits  &&  !(flags & UART0_ZS))
+      uart0_putc('0');
+  }
+}
+
+void uart0_printHex(uint32_t value, uint8_t digits)
+{
+  static const char hex[16] PROGMEM = "0123456789ABCDEF";
+  int8_t i;
+
+  if (digits > 8)
+    digits = 8;
+
+  for (i = digits - 1; i >= 0; i--)
+    uart0_putc(pgm_read_byte(&hex[(value >> (i*4)) & 0x0F]));
+}
+
 void uart0_printUInt8(uint8_t value)
 {
-  uart0_putc(value/100 + '0');
-  value %= 100;
-  uart0_putc(value/10 + '0');
-  uart0_putc(value%10 + '0');
+  uart0_printDec(value, 3, 0);
 }
 
 void uart0_printUInt8B(uint8_t value)
@@ -91,47 +293,181 @@ void uart0_printUInt8B(uint8_t value)
 
 void uart0_printUInt16(uint16_t value)
 {
-  uart0_putc(value/10000 + '0');
-  value %= 10000;
-  uart0_putc(value/1000 + '0');
-  value %= 1000;
-  uart0_putc(value/100 + '0');
-  value %= 100;
-  uart0_putc(value/10 + '0');
-  uart0_putc(value%10 + '0');
+  uart0_printDec(value, 5, 0);
 }
 
 void uart0_printInt16(int16_t value)
 {
   if (value < 0) {
     uart0_putc('-');
-    value = -value;
-  } else
+    // magnitude as unsigned, works for -32768 too
+    uart0_printDec((uint16_t)(0U - (uint16_t)value), 5, 0);
+  } else {
     uart0_putc(' ');
+    uart0_printDec(value, 5, 0);
+  }
+}
+
+void uart0_printInt32(int32_t value)
+{
+  if (value < 0) {
+    uart0_putc('-');
+    uart0_printDec((uint32_t)0 - (uint32_t)value, 1, UART0_ZS);
+  } else
+    uart0_printDec(value, 1, UART0_ZS);
+}
+
+// data register empty, transmit next byte
+ISR(USART0_UDRE_vect) {
+  if (uart0_tx_head != uart0_tx_tail) {
+    uart0_write(uart0_tx_buffer[uart0_tx_tail & UART0_TX_MASK]);
+    uart0_tx_tail++;
+  }
 
-  uart0_putc(value/10000 + '0');
-  value %= 10000;
-  uart0_putc(value/1000 + '0');
-  value %= 1000;
-  uart0_putc(value/100 + '0');
-  value %= 100;
-  uart0_putc(value/10 + '0');
-  uart0_putc(value%10 + '0');
+  if (uart0_tx_head == uart0_tx_tail)
+    UCSR0B &= ~(1<<UDRIE0); // nothing left to send
 }
 
 // receive complete
 ISR(USART0_RX_vect) {
-  uart0_receive_data = UDR0;
-  uart0_receive_flag = 1;
+  uint8_t status = UCSR0A;
+  char data = UDR0;
+
+  if (status & (1<<DOR0))
+    uart0_rx_hw_overruns++;
+
+  if (uart0_frames) {
+    if (uart0_frame_discard) {
+      // skip the rest of a lost frame
+      uart0_rx_overruns++;
+      if (data == uart0_frame_delimiter)
+	uart0_frame_discard = 0;
+      return;
+    }
+
+    if (data == uart0_frame_delimiter) {
+      if ((uint8_t)(uart0_frame_head - uart0_frame_tail) >= UART0_RX_FRAMES
+	  || (uint8_t)(uart0_rx_head - uart0_rx_tail) >= UART0_RX_SIZE) {
+	// no space for another frame, drop it
+	uart0_rx_overruns += (uint8_t)(uart0_rx_head - uart0_frame_start) + 1;
+	uart0_rx_head = uart0_frame_start;
+	return;
+      }
+      // terminate frame
+      uart0_rx_buffer[uart0_rx_head & UART0_RX_MASK] = '\0';
+      uart0_frame_end[uart0_frame_head & UART0_RX_FRAMES_MASK] = uart0_rx_head;
+      uart0_rx_head++;
+      uart0_frame_head++;
+      uart0_frame_start = uart0_rx_head;
+      return;
+    }
+
+    if ((uint8_t)(uart0_rx_head - uart0_rx_tail) >= UART0_RX_SIZE) {
+      // frame does not fit, drop it
+      uart0_rx_overruns += (uint8_t)(uart0_rx_head - uart0_frame_start) + 1;
+      uart0_rx_head = uart0_frame_start;
+      uart0_frame_discard = 1;
+      return;
+    }
+  } else if ((uint8_t)(uart0_rx_head - uart0_rx_tail) >= UART0_RX_SIZE) {
+    uart0_rx_overruns++;
+    return;
+  }
+
+  uart0_rx_buffer[uart0_rx_head & UART0_RX_MASK] = data;
+  uart0_rx_head++;
 }
 
 uint8_t uart0_getc(char* data)
 {
-  if(uart0_receive_flag) {
-    *data = uart0_receive_data;
-    uart0_receive_flag = 0;
+  if (uart0_rx_head != uart0_rx_tail) {
+    *data = uart0_rx_buffer[uart0_rx_tail & UART0_RX_MASK];
+    uart0_rx_tail++;
     return 1;
   }
 
   return 0;
 }
+
+uint16_t uart0_rxOverruns(void)
+{
+  uint16_t overruns;
+  uint8_t sreg = SREG;
+
+  cli();
+  overruns = uart0_rx_overruns;
+  SREG = sreg;
+
+  return overruns;
+}
+
+uint16_t uart0_rxHwOverruns(void)
+{
+  uint16_t overruns;
+  uint8_t sreg = SREG;
+
+  cli();
+  overruns = uart0_rx_hw_overruns;
+  SREG = sreg;
+
+  return overruns;
+}
+
+void uart0_enableFrames(char delimiter)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  // start with an empty receive buffer
+  uart0_rx_tail = uart0_rx_head;
+  uart0_frame_tail = uart0_frame_head;
+  uart0_frame_start = uart0_rx_head;
+  uart0_frame_discard = 0;
+  uart0_frame_delimiter = delimiter;
+  uart0_frames = 1;
+  SREG = sreg;
+}
+
+void uart0_disableFrames(void)
+{
+  uart0_frames = 0;
+}
+
+uint8_t uart0_frameAvailable(void)
+{
+  return uart0_frame_head != uart0_frame_tail;
+}
+
+const char* uart0_getFrame(uint8_t* length)
+{
+  uint8_t start, end, len, first;
+
+  if (uart0_frame_head == uart0_frame_tail)
+    return NULL; // no complete frame
+
+  start = uart0_rx_tail;
+  end = uart0_frame_end[uart0_frame_tail & UART0_RX_FRAMES_MASK];
+  len = end - start;
+  *length = len;
+
+  // contiguous (including terminator)?
+  first = UART0_RX_SIZE - (start & UART0_RX_MASK);
+  if (len < first)
+    return (const char*) &uart0_rx_buffer[start & UART0_RX_MASK];
+
+  // frame wraps around, copy the two parts
+  memcpy(uart0_frame_copy,
+	 (const char*) &uart0_rx_buffer[start & UART0_RX_MASK], first);
+  memcpy(uart0_frame_copy + first, (const char*) uart0_rx_buffer,
+	 len + 1 - first);
+  return uart0_frame_copy;
+}
+
+void uart0_releaseFrame(void)
+{
+  if (uart0_frame_head == uart0_frame_tail)
+    return;
+
+  uart0_rx_tail = uart0_frame_end[uart0_frame_tail & UART0_RX_FRAMES_MASK] + 1;
+  uart0_frame_tail++;
+}
@@ -0,0 +1,42 @@
+/**
+ * @file dispatch.h
+ * @date 17.10.2026
+ * @author Denise Ratasich
+ *
+ * @brief Header of the deferred callback dispatcher (bottom halves).
+ *
+ * Interrupt service routines only mark an event pending. The callbacks run
+ * later in the main loop by calling dispatch().
+ */
+
+#ifndef __DISPATCH_H__
+#define __DISPATCH_H__
+
+#include <avr/io.h>
+
+/** Number of events, i.e., priorities 0 (highest) .. DISPATCH_MAX_EVENTS-1
+ * (lowest). */
+#define DISPATCH_MAX_EVENTS     16
+
+/** Initializes this module. */
+void dispatch_init(void);
+
+/** Request an event with a priority (each priority can be used once). Returns
+ * the event (= priority) or -1 if not available. */
+int8_t dispatch_request(uint8_t priority, void (*callback)(void));
+
+/** Release an event, e.g., if not needed any more. */
+void dispatch_release(int8_t event);
+
+/** Marks an event pending (to be called from ISRs). An event posted several
+ * times before dispatching, runs its callback once. */
+void dispatch_post(int8_t event);
+
+/** Returns 1 if any event is pending. */
+uint8_t dispatch_pending(void);
+
+/** Runs the callbacks of pending events in priority order, until no event is
+ * pending any more. Call from the main loop. */
+void dispatch(void);
+
+#endif
@@ -13,6 +13,11 @@
 
 #define	GPT_MAX_TIMERS		10
 
+/** Tickless mode (1 .. on, 0 .. off). The compare match is set to the next
+ * deadline instead of interrupting every tick. Deadlines are then met with a
+ * jitter of one timer count (64us at MS1, 16us at US100). */
+#define GPT_TICKLESS            0
+
 typedef enum { MS1, US100, UNSPEC } gpt_resolution_t;
 
 /** Initializes general purpose timer. */
@@ -22,11 +27,32 @@ gpt_resolution_t gpt_init(gpt_resolution_t resolution);
  * want to count on your own. */
 uint32_t gpt_getTime(void);
 
-/** Request a GPT. */
-int8_t gpt_requestTimer(uint16_t overflowTime, void (*callback)(void));
+/** Returns current us from startup (overflow after about 71 minutes!). The
+ * resolution is 4us at MS1 and 0.5us at US100 (64us and 16us in tickless
+ * mode). */
+uint32_t gpt_getTimeUs(void);
+
+/** Request a GPT. The overflow time (in ticks) must be greater than 0. */
+int8_t gpt_requestTimer(uint32_t overflowTime, void (*callback)(void));
+
+/** Request a GPT whose callback is deferred to dispatch() with the given
+ * priority (see dispatch.h). */
+int8_t gpt_requestTimerDeferred(uint32_t overflowTime, uint8_t priority,
+                                void (*callback)(void));
+
+/** Request a one-shot GPT expiring once after the given time (in ticks). The
+ * timer keeps its slot after expiry, i.e., the id stays valid until the
+ * owner releases it with gpt_releaseTimer (also from the callback). Until
+ * then gpt_setOverflowTime or gpt_reset re-arm it. */
+int8_t gpt_requestOneShot(uint32_t time, void (*callback)(void));
+
+/** Request a one-shot GPT expiring at the given time from startup (in ticks,
+ * see gpt_getTime). A deadline already passed expires with the next tick.
+ * The owner releases it like a timer of gpt_requestOneShot. */
+int8_t gpt_requestAt(uint32_t deadline, void (*callback)(void));
 
 /** Change overflow time of a GPT. */
-void gpt_setOverflowTime(uint16_t overflowTime, int8_t timerId);
+void gpt_setOverflowTime(uint32_t overflowTime, int8_t timerId);
 
 /** Resets the remaining time to overflow time of a GPT (for watchdog-like
  * usage). */
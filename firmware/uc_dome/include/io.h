@@ -24,6 +24,7 @@
 // ----------------------------------------------------------------------
 
 // Timer 2 as general purpose timer
+// Timer 1 refreshes the logic displays
 // UART0 used for debugging
 
 // ----------------------------------------------------------------------
@@ -35,6 +36,7 @@
 #define LOGICDISPLAY_FRONT_COLS_PORT    PORTC
 #define LOGICDISPLAY_FRONT_COLS_DDR     DDRC
 #define LOGICDISPLAY_FRONT_COLS_MASK    (0xFE) // used pins of COLS_PORT
+// (COLS_PORT and REAR_PORT1 are written as a whole, PC0 and PF0 are low)
 // rear logic display
 #define LOGICDISPLAY_REAR_PORT1         PORTF
 #define LOGICDISPLAY_REAR_DDR1          DDRF
@@ -13,6 +13,7 @@ typedef enum {
     LOGICDISPLAY_RANDOM = 0, // normal operation
     LOGICDISPLAY_CHAR, // e.g., for debuging
     LOGICDISPLAY_CHASER, // for fun
+    LOGICDISPLAY_FADE, // LEDs fade in and out (grayscale)
     LOGICDISPLAY_NUM_MODES
 } logicdisplay_mode_t;
 
@@ -22,6 +23,9 @@ void logicdisplay_init(void);
 /** Change display mode. */
 void logicdisplay_mode(logicdisplay_mode_t new_mode);
 
+/** Returns the current display mode. */
+logicdisplay_mode_t logicdisplay_getMode(void);
+
 /** Sets the character to display.
  * @note The mode needs to be changed explicitely to display the characters. */
 void logicdisplay_print(const char *front_up, const char *front_lo,
@@ -0,0 +1,79 @@
+/**
+ * @file protocol.h
+ * @author Denise Ratasich
+ * @date 17.10.2026
+ *
+ * @brief Binary command/telemetry protocol over UART0.
+ *
+ * A message consists of an ID, a payload (max. PROTOCOL_MAX_PAYLOAD bytes)
+ * and the CRC-16 (XMODEM, little endian) over ID and payload. Messages are
+ * COBS encoded and terminated by a 0x00 byte. Multi-byte values in the
+ * payload are little endian.
+ *
+ * Baud rate switch: the host sends PROTOCOL_ID_BAUD, the uC answers with the
+ * same message at the current baud rate and switches. The host has to send a
+ * valid message at the new baud rate within PROTOCOL_BAUD_TIMEOUT, otherwise
+ * the uC falls back to the previous baud rate.
+ */
+
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <avr/io.h>	// e.g. uint8_t, uint16_t
+#include <avr/pgmspace.h>	// PGM_P
+
+#define PROTOCOL_MAX_PAYLOAD	32
+#define PROTOCOL_MAX_IDS	32
+#define PROTOCOL_BAUD_TIMEOUT	1000000UL	// us
+
+// message IDs, commands (host -> uC)
+#define PROTOCOL_ID_MOTOR_SPEED		0x01	// int16 speed (-PWM_TOP..PWM_TOP)
+#define PROTOCOL_ID_STEPPER_MOVE	0x02	// int32 steps (relative)
+#define PROTOCOL_ID_LD_MODE		0x03	// uint8 logic display mode
+#define PROTOCOL_ID_LD_TEXT		0x04	// char front_up[2], front_lo[2],
+						// rear[5] ('\0'-padded)
+#define PROTOCOL_ID_BAUD		0x05	// uint8 baud (enum uart0_baud)
+#define PROTOCOL_ID_MOTOR_TARGET	0x06	// int32 target speed (counts/s)
+#define PROTOCOL_ID_MOTOR_CLEAR		0x07	// clear motor fault (no payload)
+// message IDs, telemetry (uC -> host)
+#define PROTOCOL_ID_BODY_TELEMETRY	0x10	// uint32 time, int16 speed,
+						// int32 stepper position,
+						// int32 encoder velocity,
+						// uint16 max. control time (us),
+						// uint16 motor current (ADC),
+						// uint8 motor fault
+#define PROTOCOL_ID_DOME_TELEMETRY	0x11	// uint32 time, uint8 mode
+#define PROTOCOL_ID_LOG			0x12	// uint8 level, char text[]
+						// (not terminated)
+
+// levels of log messages
+#define PROTOCOL_LOG_INFO	0
+#define PROTOCOL_LOG_ERROR	1
+
+typedef void (*protocol_handler_t)(const uint8_t *payload, uint8_t length);
+
+/** Initializes the protocol (enables frames on UART0). */
+void protocol_init(void);
+
+/** Sets the function handling messages with the given ID (NULL to remove). */
+int8_t protocol_registerHandler(uint8_t id, protocol_handler_t handler);
+
+/** Returns 1 if a received frame is waiting to be processed. */
+uint8_t protocol_pending(void);
+
+/** Decodes the received frames and calls the handlers. Call from the main
+ * loop. */
+void protocol_poll(void);
+
+/** Sends a message. */
+void protocol_send(uint8_t id, const void *payload, uint8_t length);
+
+/** Sends a text in flash (e.g., PSTR("...")) as log message, truncated to
+ * the maximum payload. Use instead of ASCII output on UART0. */
+void protocol_log_P(uint8_t level, PGM_P text);
+
+/** Returns the number of invalid frames received (encoding, CRC, unknown
+ * ID). */
+uint16_t protocol_errors(void);
+
+#endif
@@ -10,16 +10,68 @@
 #define __UART0_H__
 
 #include <avr/io.h>	// e.g. uint8_t, uint16_t
+#include <avr/pgmspace.h>	// PGM_P
 
-void uart0_init();
+/** Size of the transmit buffer (power of 2, max. 128). */
+#define UART0_TX_SIZE	128
+/** Size of the receive buffer (power of 2, max. 128). */
+#define UART0_RX_SIZE	128
+/** Max. number of complete frames in the receive buffer (power of 2). */
+#define UART0_RX_FRAMES	8
+
+/** Flag for uart0_printDec: suppress leading zeros. */
+#define UART0_ZS	0x01
+
+/** Baud rates (with U2X; 0.5, 1 and 2 Mbaud have no error at 16MHz). */
+enum uart0_baud {
+  UART0_BAUD_9600 = 0,
+  UART0_BAUD_19200,
+  UART0_BAUD_57600,
+  UART0_BAUD_115200,
+  UART0_BAUD_500000,
+  UART0_BAUD_1000000,
+  UART0_BAUD_2000000,
+  UART0_BAUD_NUM
+};
+
+/** Behavior of uart0_putc when the transmit buffer is full. */
+enum uart0_txpolicy {
+  UART0_TX_DROP = 0,	// discard the new byte
+  UART0_TX_BLOCK,	// wait until there is space
+  UART0_TX_OVERWRITE	// discard the oldest byte
+};
+
+void uart0_init(enum uart0_baud);
+void uart0_setBaud(enum uart0_baud);	// after sending pending bytes
+enum uart0_baud uart0_getBaud(void);
+void uart0_flush(void);	// wait until all bytes are sent (interrupts on!)
+void uart0_setTxPolicy(enum uart0_txpolicy);
+uint16_t uart0_txDropped(void);	// bytes discarded due to full buffer
+uint8_t uart0_txHighWater(void);	// max. number of bytes in buffer
 void uart0_putc(char);
 void uart0_print(char*);
 void uart0_println(char*);
+void uart0_print_P(PGM_P);	// string in flash, e.g., PSTR("text")
+void uart0_println_P(PGM_P);
+// value with at least 'digits' digits (leading zeros unless UART0_ZS)
+void uart0_printDec(uint32_t value, uint8_t digits, uint8_t flags);
+void uart0_printHex(uint32_t value, uint8_t digits);
 void uart0_printUInt8(uint8_t);
 void uart0_printUInt16(uint16_t);
 void uart0_printInt16(int16_t);
+void uart0_printInt32(int32_t);	// without leading zeros
 void uart0_printUInt8B(uint8_t);
 uint8_t uart0_getc(char*);
+uint16_t uart0_rxOverruns(void);	// bytes lost due to full buffer
+uint16_t uart0_rxHwOverruns(void);	// bytes lost in hardware (data overrun)
+// frames, e.g., delimiter '\n' for lines or '\0' for COBS (don't use
+// uart0_getc while enabled)
+void uart0_enableFrames(char delimiter);
+void uart0_disableFrames(void);
+uint8_t uart0_frameAvailable(void);
+const char* uart0_getFrame(uint8_t*);
+void uart0_releaseFrame(void);
 // receive-ISR UART0
+// data register empty-ISR UART0
 
 #endif
@@ -6,16 +6,33 @@
  * @brief General purpose timer implementation (1ms resolution).
  *
  * Timer 2 (8-bit timer) used as general purpose timer (GPT). Timer resolution
- * is 1ms. Maximum overflow time is 65535ms (i.e., 65s).
+ * is 1ms. Maximum overflow time is 2^32-1 ticks (i.e., about 49 days).
+ *
+ * Running timers are kept in a list sorted by expiry. Each element stores the
+ * number of ticks after its predecessor expires (delta), so the ISR only
+ * decrements the head and touches the timers which actually expire.
+ *
+ * In tickless mode (GPT_TICKLESS) Timer 2 runs freely with a larger prescaler
+ * and the compare match is set to the next deadline (or at most
+ * GPT_MAX_COUNTS ahead). Elapsed counts are accumulated in units of 4us and
+ * converted to ticks whenever the interrupt fires or the time is read.
  */
 
 #include <avr/interrupt.h>
 #include "gpt.h"
+#include "dispatch.h"
+
+/** Maximum counts between two compare interrupts in tickless mode. */
+#define GPT_MAX_COUNTS          250
 
 typedef struct {
     void (*callback)(void);
-    uint16_t overflowTime;
-    uint16_t remainingTime;
+    uint32_t overflowTime; // 0 .. unused
+    uint32_t delta; // ticks after expiry of predecessor
+    int8_t next; // next timer in the expiry list (-1 .. end of list)
+    uint8_t queued; // 1 .. timer is in the expiry list
+    int8_t event; // deferred callback event (-1 .. callback called in ISR)
+    uint8_t oneShot; // 1 .. not re-armed after expiry
 } GPTimer_t;
 
 static volatile uint32_t time = 0;
@@ -26,18 +43,203 @@ static uint8_t numTimers = 0;
 /** Timer element, collects information to timer requests. */
 static volatile GPTimer_t timers[GPT_MAX_TIMERS];
 
+/** Timer expiring next (-1 .. no timer running). */
+static volatile int8_t head = -1;
+
+/** Ticks elapsed but not yet applied to the expiry list. */
+static uint16_t pending = 0;
+
 /** Initialized flag. */
 static gpt_resolution_t initialized = UNSPEC;
 
+#if GPT_TICKLESS
+/** Counter value up to which the time has been accounted. */
+static uint8_t lastCount = 0;
+/** Accounted time not yet making up a full tick (in units of 4us). */
+static uint16_t subTicks = 0;
+/** Length of a tick in units of 4us. */
+static uint16_t tickUnits;
+/** Length of a timer count in units of 4us (as power of 2). */
+static uint8_t countShift;
+#endif
+
+/** Inserts a timer into the expiry list (interrupts must be disabled). */
+static void gpt_insert(int8_t timerId, uint32_t ticks)
+{
+    int8_t prev = -1;
+    int8_t cur = head;
+
+    // skip timers expiring earlier or at the same time (keep FIFO order)
+    while (cur >= 0 && timers[cur].delta <= ticks) {
+        ticks -= timers[cur].delta;
+        prev = cur;
+        cur = timers[cur].next;
+    }
+
+    timers[timerId].delta = ticks;
+    timers[timerId].next = cur;
+    timers[timerId].queued = 1;
+    if (cur >= 0)
+        timers[cur].delta -= ticks;
+
+    if (prev < 0)
+        head = timerId;
+    else
+        timers[prev].next = timerId;
+}
+
+/** Removes a timer from the expiry list (interrupts must be disabled). */
+static void gpt_unlink(int8_t timerId)
+{
+    int8_t prev = -1;
+    int8_t cur = head;
+
+    if (!timers[timerId].queued)
+        return;
+
+    while (cur >= 0 && cur != timerId) {
+        prev = cur;
+        cur = timers[cur].next;
+    }
+    if (cur < 0)
+        return; // should never happen
+
+    // pass remaining time to successor
+    cur = timers[timerId].next;
+    if (cur >= 0)
+        timers[cur].delta += timers[timerId].delta;
+
+    if (prev < 0)
+        head = cur;
+    else
+        timers[prev].next = cur;
+    timers[timerId].queued = 0;
+}
+
+/** Removes expired timers from the list, re-arms and calls them. */
+static void gpt_expire(void)
+{
+    int8_t i;
+
+    while (head >= 0)
+    {
+        if (timers[head].delta > pending) {
+            timers[head].delta -= pending;
+            break;
+        }
+
+        // time elapsed
+        i = head;
+        pending -= timers[i].delta;
+        head = timers[i].next;
+        timers[i].queued = 0;
+
+        // re-arm before the callback, so the callback may change or release
+        // its own timer (a one-shot keeps its slot until released by the
+        // owner)
+        if (!timers[i].oneShot)
+            gpt_insert(i, timers[i].overflowTime);
+        if (timers[i].event >= 0)
+            dispatch_post(timers[i].event); // call in main loop
+        else
+            (*(timers[i].callback))(); // call callback-function
+    }
+
+    pending = 0;
+}
+
+#if GPT_TICKLESS
+/** Converts the counts elapsed since the last call to ticks (interrupts must
+ * be disabled). */
+static void gpt_sync(void)
+{
+    uint8_t now = TCNT2;
+
+    subTicks += (uint16_t)((uint8_t)(now - lastCount)) << countShift;
+    lastCount = now;
+
+    while (subTicks >= tickUnits) {
+        subTicks -= tickUnits;
+        time++;
+        pending++;
+    }
+}
+
+/** Sets the compare match to the next deadline (interrupts must be
+ * disabled). */
+static void gpt_schedule(void)
+{
+    uint16_t counts = GPT_MAX_COUNTS;
+    uint16_t units;
+    uint8_t elapsed;
+
+    if (head >= 0 && timers[head].delta < GPT_MAX_COUNTS + pending) {
+        if (timers[head].delta > pending) {
+            units = (timers[head].delta - pending) * tickUnits - subTicks;
+            counts = (units + (1 << countShift) - 1) >> countShift;
+            if (counts > GPT_MAX_COUNTS)
+                counts = GPT_MAX_COUNTS;
+        } else
+            counts = 0; // already due
+    }
+
+    // counts are relative to lastCount, keep compare ahead of the counter
+    elapsed = TCNT2 - lastCount;
+    if (counts < elapsed + 2)
+        counts = elapsed + 2;
+
+    OCR2A = lastCount + counts;
+}
+#endif
+
+/** Starts a timer expiring the given number of ticks from now (interrupts
+ * must be disabled). */
+static void gpt_start(int8_t timerId, uint32_t ticks)
+{
+#if GPT_TICKLESS
+    gpt_sync();
+    gpt_insert(timerId, ticks + pending);
+    gpt_schedule();
+#else
+    gpt_insert(timerId, ticks + pending);
+#endif
+}
+
 gpt_resolution_t gpt_init(gpt_resolution_t resolution)
 {
     if (initialized != UNSPEC)
         return initialized;
 
     // mark timer elements as unused
-    for (uint8_t i = 0; i < GPT_MAX_TIMERS; i++)
+    for (uint8_t i = 0; i < GPT_MAX_TIMERS; i++) {
         timers[i].overflowTime = 0;
+        timers[i].queued = 0;
+    }
+    head = -1;
 
+#if GPT_TICKLESS
+    // init Timer 2 (8-Bit Timer)
+    TCCR2A = 0x00; // normal mode, counter runs freely
+    switch(resolution) {
+    case MS1:
+        // prescaler = 1024 (tpuls = 64us), starts timer
+        TCCR2B |= (7<<CS20);
+        countShift = 4; // 16 * 4us
+        tickUnits = 250; // 1 ms
+        break;
+    case US100:
+        // prescaler = 256 (tpuls = 16us), starts timer
+        TCCR2B |= (6<<CS20);
+        countShift = 2; // 4 * 4us
+        tickUnits = 25; // 0.1 ms
+        break;
+    default:
+        // timer won't be started
+        return initialized = UNSPEC;
+    }
+    lastCount = TCNT2;
+    OCR2A = lastCount + GPT_MAX_COUNTS;
+#else
     // init Timer 2 (8-Bit Timer)
     TCCR2A = 0x02; // CTC mode
     switch(resolution) {
@@ -55,6 +257,7 @@ gpt_resolution_t gpt_init(gpt_resolution_t resolution)
         // timer won't be started
         return initialized = UNSPEC;
     }
+#endif
 
     // enable compare match interrupt
     TIMSK2 |= (1<<OCIE2A);
@@ -65,25 +268,83 @@ gpt_resolution_t gpt_init(gpt_resolution_t resolution)
 
 uint32_t gpt_getTime(void)
 {
-    return time;
+#if GPT_TICKLESS
+    uint32_t now;
+    uint8_t sreg = SREG;
+
+    cli();
+    gpt_sync();
+    now = time;
+    SREG = sreg;
+
+    return now;
+#else
+    uint32_t now;
+    uint8_t sreg = SREG;
+
+    // 32-bit read is not atomic
+    cli();
+    now = time;
+    SREG = sreg;
+
+    return now;
+#endif
 }
 
-int8_t gpt_requestTimer(uint16_t overflowTime, void (*callback)(void))
+uint32_t gpt_getTimeUs(void)
+{
+    uint32_t t;
+    uint8_t sreg = SREG;
+
+    cli();
+#if GPT_TICKLESS
+    gpt_sync();
+    t = time;
+    uint16_t units = subTicks; // in 4us
+    SREG = sreg;
+
+    if (initialized == US100)
+        return t * 100 + units * 4;
+    return t * 1000 + units * 4;
+#else
+    t = time;
+    uint8_t c = TCNT2;
+    // compare match pending, i.e., counter restarted but tick not counted yet
+    if ((TIFR2 & (1<<OCF2A)) && c < OCR2A)
+        t++;
+    SREG = sreg;
+
+    if (initialized == US100)
+        return t * 100 + (c >> 1); // c in 0.5us
+    return t * 1000 + (uint16_t)c * 4; // c in 4us
+#endif
+}
+
+/** Request a GPT with deferred (event >= 0) or immediate callback. */
+static int8_t gpt_request(uint32_t overflowTime, void (*callback)(void),
+                          int8_t event, uint8_t oneShot)
 {
-    uint8_t i;
     int8_t timerId = -1;
+    uint8_t sreg = SREG;
+
+    if (overflowTime == 0)
+        return -1;
+
+    cli();
 
     // search for a free timer element
     if (numTimers < GPT_MAX_TIMERS)
     {
-        for (i = 0; i < GPT_MAX_TIMERS; i++)
+        for (uint8_t i = 0; i < GPT_MAX_TIMERS; i++)
         {
             if (timers[i].overflowTime == 0)
             {
                 // free element found
                 timers[i].callback = callback;
-                timers[i].remainingTime = overflowTime;
+                timers[i].event = event;
+                timers[i].oneShot = oneShot;
                 timers[i].overflowTime = overflowTime;
+                gpt_start(i, overflowTime);
                 timerId = i;
                 numTimers++;
                 break;
@@ -91,48 +352,113 @@ int8_t gpt_requestTimer(uint16_t overflowTime, void (*callback)(void))
         }
     }
 
+    SREG = sreg;
     return timerId;
 }
 
-void gpt_setOverflowTime(uint16_t overflowTime, int8_t timerId)
+int8_t gpt_requestTimer(uint32_t overflowTime, void (*callback)(void))
 {
-    if (timerId >= 0 && timerId < GPT_MAX_TIMERS) {
-        timers[timerId].remainingTime = overflowTime;
+    return gpt_request(overflowTime, callback, -1, 0);
+}
+
+int8_t gpt_requestTimerDeferred(uint32_t overflowTime, uint8_t priority,
+                                void (*callback)(void))
+{
+    int8_t event = dispatch_request(priority, callback);
+    if (event < 0)
+        return -1;
+
+    int8_t timerId = gpt_request(overflowTime, callback, event, 0);
+    if (timerId < 0)
+        dispatch_release(event);
+
+    return timerId;
+}
+
+int8_t gpt_requestOneShot(uint32_t time, void (*callback)(void))
+{
+    return gpt_request(time, callback, -1, 1);
+}
+
+int8_t gpt_requestAt(uint32_t deadline, void (*callback)(void))
+{
+    uint8_t sreg = SREG;
+
+    cli();
+#if GPT_TICKLESS
+    gpt_sync();
+#endif
+    int32_t ticks = (int32_t)(deadline - time);
+    if (ticks <= 0)
+        ticks = 1;
+    int8_t timerId = gpt_request(ticks, callback, -1, 1);
+    SREG = sreg;
+
+    return timerId;
+}
+
+void gpt_setOverflowTime(uint32_t overflowTime, int8_t timerId)
+{
+    uint8_t sreg = SREG;
+
+    if (timerId < 0 || timerId >= GPT_MAX_TIMERS || overflowTime == 0)
+        return;
+
+    cli();
+    if (timers[timerId].overflowTime != 0) {
+        gpt_unlink(timerId);
         timers[timerId].overflowTime = overflowTime;
+        gpt_start(timerId, overflowTime);
     }
+    SREG = sreg;
 }
 
 void gpt_reset(int8_t timerId)
 {
-    if(timerId >= 0 && timerId < GPT_MAX_TIMERS)
-        timers[timerId].remainingTime = timers[timerId].overflowTime;
+    uint8_t sreg = SREG;
+
+    if (timerId < 0 || timerId >= GPT_MAX_TIMERS)
+        return;
+
+    cli();
+    if (timers[timerId].overflowTime != 0) {
+        gpt_unlink(timerId);
+        gpt_start(timerId, timers[timerId].overflowTime);
+    }
+    SREG = sreg;
 }
 
 void gpt_releaseTimer(int8_t timerId)
 {
-    if(timerId >= 0 && timerId < GPT_MAX_TIMERS) {
+    uint8_t sreg = SREG;
+
+    if (timerId < 0 || timerId >= GPT_MAX_TIMERS)
+        return;
+
+    cli();
+    if (timers[timerId].overflowTime != 0) {
+        gpt_unlink(timerId);
         timers[timerId].overflowTime = 0;
         numTimers--;
+        dispatch_release(timers[timerId].event);
     }
+    SREG = sreg;
 }
 
-// called every 1ms
+#if GPT_TICKLESS
+// called on the next deadline, or at least every GPT_MAX_COUNTS counts
+ISR(TIMER2_COMPA_vect)
+{
+    gpt_sync();
+    gpt_expire();
+    gpt_schedule();
+}
+#else
+// called every tick (1ms or 100us)
 ISR(TIMER2_COMPA_vect)
 {
-    uint8_t i;
-
     time++;
-
-    for(i = 0; i < GPT_MAX_TIMERS; i++)
-    {
-        if(timers[i].overflowTime != 0) // is timer element used?
-        {
-            timers[i].remainingTime--;
-            if(timers[i].remainingTime == 0) // time ellapsed?
-            {
-                timers[i].remainingTime = timers[i].overflowTime;
-                (*(timers[i].callback))(); // call callback-function
-            }
-        }
-    }
+    pending++;
+    gpt_expire();
 }
+#endif
@@ -16,6 +16,24 @@
  * front display gives row switch rate of <2ms. Switching all 22 columns of the
  * rear display with >60Hz we have to update at <0.7ms.
  *
+ * A frame is compiled into the port values of each scan slot (row of the
+ * front, column of the rear display) when it changes. The refresh only
+ * writes the prepared values to the ports.
+ *
+ * The LEDs have LD_BAM_BITS bit brightness by bit-angle modulation: a scan
+ * slot is shown once per bit plane, plane b for 2^b time units (timer 1 in
+ * fast PWM mode with TOP = OCR1A, the ISR loads the weight of the plane after
+ * the shown one into the double buffered OCR1A, taken over at BOTTOM; a late
+ * ISR does not miss TOP like a reload in CTC mode would). The refresh runs LD_BAM_BITS times per slot independent of the
+ * brightness levels. With 4 bits and 24us per unit a slot takes 360us, i.e.,
+ * front >340Hz, rear >120Hz. On/off frames show all planes (full
+ * brightness).
+ *
+ * The compiled frames are double buffered. Renderers build a frame in
+ * frame_front/frame_rear (not scanned) and compile it into the back buffer.
+ * The refresh swaps front and back buffer of a display at the end of its
+ * scan cycle, i.e., a frame is always shown completely.
+ *
  * Low on row r and high on column c means the LED_{r,c} is on for front logic
  * display, rear is vice versa.
  */
@@ -25,6 +43,7 @@
 #include "gpt.h"
 
 #include <avr/io.h>	// e.g., uint8_t
+#include <avr/interrupt.h>
 #include <stdlib.h>     // rand, srand
 
 #define LD_FRONT_ROWS           (8)
@@ -36,10 +55,60 @@
 #define LD_REAR_DISABLE_DM      (0x02) // enable pin for demux (active low)
 #define LD_REAR_COLS_DM         (0x0F) // column pins to demux
 #define LD_REAR_ROWS_UC         (0xF0) // row pins of PORT2 (active high)
+#define LD_REAR_OFF             (LD_REAR_COLS_UC | LD_REAR_DISABLE_DM)
+
+#define LD_BAM_BITS             (4) // bit planes, i.e., brightness levels 2^n
+#define LD_BAM_LEVEL_MAX        ((1 << LD_BAM_BITS) - 1)
+#define LD_BAM_UNIT             (48) // time of plane 0 (timer 1 counts, 0.5us)
+
+#define LD_FRAME_PRIORITY       (8) // dispatch priority of frame changes
 
 /** Status of the LEDs (0/1 .. on/off; one byte -- columns -- for each row) */
-static volatile uint8_t frame_front[LD_FRONT_ROWS];
-static volatile uint8_t frame_rear[LD_REAR_COLS];
+static uint8_t frame_front[LD_FRONT_ROWS];
+static uint8_t frame_rear[LD_REAR_COLS];
+
+/** Brightness of the LEDs (0 .. LD_BAM_LEVEL_MAX) in mode 'FADE'. */
+static uint8_t level_front[LD_FRONT_ROWS][LD_FRONT_COLS];
+static uint8_t level_rear[LD_REAR_COLS][LD_REAR_ROWS];
+/** Target brightness of fading LEDs. */
+static uint8_t target_front[LD_FRONT_ROWS][LD_FRONT_COLS];
+static uint8_t target_rear[LD_REAR_COLS][LD_REAR_ROWS];
+
+/** Port values of a scan slot of the front display. */
+typedef struct {
+    uint8_t rows; // FRONT_ROWS_PORT, one row on
+    uint8_t cols; // FRONT_COLS_PORT
+} ld_front_slot_t;
+
+/** Port values of a scan slot of the rear display. */
+typedef struct {
+    uint8_t port2; // rows and demux select
+    uint8_t port1; // column enable
+} ld_rear_slot_t;
+
+/** Compiled frames (front and back buffer, bit planes of a slot one after
+ * another), written to the ports by the refresh. */
+static volatile ld_front_slot_t scan_front[2][LD_FRONT_ROWS * LD_BAM_BITS];
+static volatile ld_rear_slot_t scan_rear[2][LD_REAR_COLS * LD_BAM_BITS];
+
+/** Compare values of the bit planes (time units weighted by 2^b, up to 4
+ * bits). */
+#if LD_BAM_BITS > 4
+#error "LD_BAM_BITS > 4 not supported"
+#endif
+static const uint16_t ld_bam_period[] = {
+    LD_BAM_UNIT - 1, 2*LD_BAM_UNIT - 1, 4*LD_BAM_UNIT - 1, 8*LD_BAM_UNIT - 1
+};
+
+/** Buffers currently scanned. */
+static volatile uint8_t shown_front = 0;
+static volatile uint8_t shown_rear = 0;
+
+#define LD_SWAP_FRONT           (0x01)
+#define LD_SWAP_REAR            (0x02)
+
+/** Back buffers to be shown at the end of the current scan cycle. */
+static volatile uint8_t swap = 0;
 
 /** Display mode. */
 static logicdisplay_mode_t mode = LOGICDISPLAY_RANDOM;
@@ -101,6 +170,121 @@ static const uint8_t ld_char_rear['Z'-'A'+1][3] = {
 };
 
 
+// low-level control
+
+/** Returns the columns of a front row in a bit plane (bit c .. column c). */
+static uint8_t logicdisplay_plane_front(uint8_t r, uint8_t b)
+{
+    if (mode != LOGICDISPLAY_FADE)
+        return frame_front[r]; // on/off in all planes
+
+    uint8_t bits = 0;
+    for (uint8_t c = 0; c < LD_FRONT_COLS; c++)
+        bits |= ((level_front[r][c] >> b) & 0x01) << c;
+    return bits;
+}
+
+/** Returns the rows of a rear column in a bit plane (bit r .. row r). */
+static uint8_t logicdisplay_plane_rear(uint8_t c, uint8_t b)
+{
+    if (mode != LOGICDISPLAY_FADE)
+        return frame_rear[c];
+
+    uint8_t bits = 0;
+    for (uint8_t r = 0; r < LD_REAR_ROWS; r++)
+        bits |= ((level_rear[c][r] >> b) & 0x01) << r;
+    return bits;
+}
+
+/** Compiles the frames into the port values of the scan slots (back
+ * buffer) and requests the swap. */
+static void logicdisplay_compile(void)
+{
+    // cancel a pending swap, i.e., the back buffers are not scanned
+    swap = 0;
+    volatile ld_front_slot_t *back_front = scan_front[!shown_front];
+    volatile ld_rear_slot_t *back_rear = scan_rear[!shown_rear];
+
+    // front
+    // high on row r, high on columns of LEDs on
+    for (uint8_t r = 0; r < LD_FRONT_ROWS; r++) {
+        for (uint8_t b = 0; b < LD_BAM_BITS; b++) {
+            back_front->rows = 1 << r;
+            back_front->cols = (logicdisplay_plane_front(r, b) << 1)
+                & LOGICDISPLAY_FRONT_COLS_MASK;
+            back_front++;
+        }
+    }
+
+    // rear
+    // high on rows of LEDs on, low on column c
+    for (uint8_t c = 0; c < LD_REAR_COLS; c++) {
+        uint8_t select = 0;
+        uint8_t port1 = LD_REAR_OFF;
+        if (c < 16) {
+            // first 16 LED columns controlled by demux
+            select = c;
+            port1 &= ~(LD_REAR_DISABLE_DM);
+        } else {
+            // top 6 LED columns controlled by uc directly
+            port1 &= ~(1 << (c-16+2));
+        }
+        for (uint8_t b = 0; b < LD_BAM_BITS; b++) {
+            back_rear->port2 = ((logicdisplay_plane_rear(c, b) << 4)
+                                & LD_REAR_ROWS_UC) | select;
+            back_rear->port1 = port1;
+            back_rear++;
+        }
+    }
+
+    // show at the end of the scan cycles
+    swap = LD_SWAP_FRONT | LD_SWAP_REAR;
+}
+
+/** Applys the next bit plane of the scan slots of both displays to the LEDs
+ * (timer 1 compare match at TOP, time of the previous plane elapsed). */
+ISR(TIMER1_COMPA_vect)
+{
+    static volatile ld_front_slot_t *front = scan_front[0];
+    static volatile ld_rear_slot_t *rear = scan_rear[0];
+    static uint8_t plane = 1 % LD_BAM_BITS; // plane of the next period
+
+    // front
+    // turn off current row, apply columns, turn on next row
+    LOGICDISPLAY_FRONT_ROWS_PORT = 0;
+    LOGICDISPLAY_FRONT_COLS_PORT = front->cols;
+    LOGICDISPLAY_FRONT_ROWS_PORT = front->rows;
+
+    // rear
+    // turn off all columns, apply rows, turn on next column
+    LOGICDISPLAY_REAR_PORT1 = LD_REAR_OFF;
+    LOGICDISPLAY_REAR_PORT2 = rear->port2;
+    LOGICDISPLAY_REAR_PORT1 = rear->port1;
+
+    // this plane runs with the weight loaded at BOTTOM, set the one of the
+    // next plane (one interrupt ahead, buffered until the next BOTTOM)
+    OCR1A = ld_bam_period[plane];
+    if (++plane == LD_BAM_BITS)
+        plane = 0;
+
+    if (++front == &scan_front[shown_front][LD_FRONT_ROWS * LD_BAM_BITS]) {
+        // end of scan cycle
+        if (swap & LD_SWAP_FRONT) {
+            shown_front = !shown_front;
+            swap &= ~LD_SWAP_FRONT;
+        }
+        front = scan_front[shown_front];
+    }
+    if (++rear == &scan_rear[shown_rear][LD_REAR_COLS * LD_BAM_BITS]) {
+        if (swap & LD_SWAP_REAR) {
+            shown_rear = !shown_rear;
+            swap &= ~LD_SWAP_REAR;
+        }
+        rear = scan_rear[shown_rear];
+    }
+}
+
+
 // modes of operation
 
 /** Changes the frame in mode 'RANDOM'. */
@@ -115,6 +299,8 @@ static void logicdisplay_frame_random(void)
     for (uint8_t c = 0; c < LD_REAR_COLS; c++) {
         frame_rear[c] = (uint8_t) rand();
     }
+
+    logicdisplay_compile();
 }
 
 /** Changes the frame in mode 'CHAR'. */
@@ -125,7 +311,7 @@ void logicdisplay_print(const char *front_up, const char *front_lo,
     uint8_t fl_max = (LD_FRONT_COLS+1)/4;
     uint8_t re_max = (LD_REAR_COLS+1)/4;
 
-    // reset frames
+    // reset frames (not scanned, i.e., no blank frame shown)
     for (uint8_t r = 0; r < LD_FRONT_ROWS; r++)
         frame_front[r] = 0x00;
     for (uint8_t c = 0; c < LD_REAR_COLS; c++)
@@ -167,6 +353,8 @@ void logicdisplay_print(const char *front_up, const char *front_lo,
             frame_rear[off+2] |= c[2];
         }
     }
+
+    logicdisplay_compile();
 }
 
 /** Changes the frame in mode 'CHASER'. */
@@ -204,63 +392,33 @@ static void logicdisplay_frame_chaser(void)
     if (posr <= 0)
         dirr = +1;
     posr = (posr + dirr) % LD_REAR_COLS;
-}
-
 
-// low-level control
-
-/** Turn off all columns. */
-static void logicdisplay_rear_reset_columns(void) {
-    // 1 .. off
-    LOGICDISPLAY_REAR_PORT1 |= LD_REAR_COLS_UC;
-    // disable demux (all outputs high)
-    LOGICDISPLAY_REAR_PORT1 |= LD_REAR_DISABLE_DM;
-}
-
-/** Switch to the specified column (0 .. LD_REAR_COLS-1). */
-static void logicdisplay_rear_set_column(uint8_t column) {
-    // 0 .. on
-    if (column < 16) {
-        // first 16 LED columns controlled by demux
-        // set column and enable
-        LOGICDISPLAY_REAR_PORT2 &= ~(LD_REAR_COLS_DM);
-        LOGICDISPLAY_REAR_PORT2 |= column;
-        LOGICDISPLAY_REAR_PORT1 &= ~(LD_REAR_DISABLE_DM);
-    } else {
-        // top 6 LED columns controlled by uc directly
-        LOGICDISPLAY_REAR_PORT1 &= ~(1 << (column-16+2));
-    }
+    logicdisplay_compile();
 }
 
-/** Applys a row frame to the LEDs. */
-static void logicdisplay_rear_apply(uint8_t frame) {
-    // 1 .. on
-    LOGICDISPLAY_REAR_PORT2 &= ~(LD_REAR_ROWS_UC);
-    LOGICDISPLAY_REAR_PORT2 |= ((frame<<4) & LD_REAR_ROWS_UC);
+/** Fades a LED one level towards its target, a new random target is chosen
+ * when reached. */
+static void logicdisplay_fade(uint8_t *level, uint8_t *target)
+{
+    if (*level < *target)
+        (*level)++;
+    else if (*level > *target)
+        (*level)--;
+    else
+        *target = (uint8_t) rand() & LD_BAM_LEVEL_MAX;
 }
 
-/** Applys columns of the frame to the LEDs subsequently. */
-static void logicdisplay_step(void)
+/** Changes the frame in mode 'FADE'. */
+static void logicdisplay_frame_fade(void)
 {
-    static uint8_t row = 0;
-    static uint8_t col = 0;
-
-    // front
-    // turn off current row
-    LOGICDISPLAY_FRONT_ROWS_PORT = 0;
-    // switch to next row
-    row = (row + 1) % LD_FRONT_ROWS;
-    // apply current column
-    LOGICDISPLAY_FRONT_COLS_PORT &= ~LOGICDISPLAY_FRONT_COLS_MASK;
-    LOGICDISPLAY_FRONT_COLS_PORT |= frame_front[row] << 1;
-    // turn on a row
-    LOGICDISPLAY_FRONT_ROWS_PORT = (1 << row);
+    for (uint8_t r = 0; r < LD_FRONT_ROWS; r++)
+        for (uint8_t c = 0; c < LD_FRONT_COLS; c++)
+            logicdisplay_fade(&level_front[r][c], &target_front[r][c]);
+    for (uint8_t c = 0; c < LD_REAR_COLS; c++)
+        for (uint8_t r = 0; r < LD_REAR_ROWS; r++)
+            logicdisplay_fade(&level_rear[c][r], &target_rear[c][r]);
 
-    // rear
-    logicdisplay_rear_reset_columns();
-    col = (col + 1) % LD_REAR_COLS;
-    logicdisplay_rear_apply(frame_rear[col]);
-    logicdisplay_rear_set_column(col);
+    logicdisplay_compile();
 }
 
 
@@ -276,9 +434,21 @@ void logicdisplay_init(void)
     LOGICDISPLAY_REAR_DDR1 = LOGICDISPLAY_REAR_MASK1;
     LOGICDISPLAY_REAR_DDR2 = LOGICDISPLAY_REAR_MASK2;
 
+    // init refresh, timer 1 in fast PWM mode with top OCR1A (WGM1: 0xF),
+    // prescaler 8, OCR1A written in normal mode (not buffered) for the
+    // first plane
+    logicdisplay_compile();
+    TCCR1B = 0x00;
+    TCCR1A = 0x00;
+    OCR1A = ld_bam_period[0];
+    TCNT1 = 0;
+    TCCR1A = (1 << WGM11) | (1 << WGM10);
+    TCCR1B = (1 << WGM13) | (1 << WGM12) | (1 << CS11);
+    TIMSK1 |= (1 << OCIE1A);
+    sei();
+
     // init frame change
     gpt_init(US100);
-    gpt_requestTimer(5, logicdisplay_step);
     logicdisplay_mode(LOGICDISPLAY_RANDOM);
 
     // init random number generator
@@ -293,6 +463,7 @@ void logicdisplay_mode(logicdisplay_mode_t new_mode)
     switch(mode) {
     case LOGICDISPLAY_RANDOM:
     case LOGICDISPLAY_CHASER:
+    case LOGICDISPLAY_FADE:
         gpt_releaseTimer(gptid);
         break;
     case LOGICDISPLAY_CHAR:
@@ -306,14 +477,20 @@ void logicdisplay_mode(logicdisplay_mode_t new_mode)
     // apply new mode
     switch(new_mode) {
     case LOGICDISPLAY_RANDOM:
-        gptid = gpt_requestTimer(2500, logicdisplay_frame_random);
+        gptid = gpt_requestTimerDeferred(2500, LD_FRAME_PRIORITY,
+                                         logicdisplay_frame_random);
         break;
     case LOGICDISPLAY_CHAR:
         // nothing to do here
         // set character to update frame
         break;
     case LOGICDISPLAY_CHASER:
-        gptid = gpt_requestTimer(500, logicdisplay_frame_chaser);
+        gptid = gpt_requestTimerDeferred(500, LD_FRAME_PRIORITY,
+                                         logicdisplay_frame_chaser);
+        break;
+    case LOGICDISPLAY_FADE:
+        gptid = gpt_requestTimerDeferred(400, LD_FRAME_PRIORITY,
+                                         logicdisplay_frame_fade);
         break;
     default:
         // shall not be used -- abort
@@ -323,3 +500,8 @@ void logicdisplay_mode(logicdisplay_mode_t new_mode)
     // save new mode
     mode = new_mode;
 }
+
+logicdisplay_mode_t logicdisplay_getMode(void)
+{
+    return mode;
+}
@@ -6,11 +6,16 @@
  * @brief Controls front logic display.
  */
 
+#include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include "io.h" // toggle bit
 #include "uart0.h"
+#include "dispatch.h"
 #include "gpt.h"
 #include "logicdisplay.h"
+#include "protocol.h"
+
+#include <string.h>
 
 
 /** Toggles alive LED. */
@@ -19,6 +24,39 @@ void led_blink(void)
   TOGGLE_BIT(PORTB, PB7);
 }
 
+/** Sends time and display mode. */
+void telemetry(void)
+{
+  struct {
+    uint32_t time;
+    uint8_t mode;
+  } msg;
+
+  msg.time = gpt_getTime();
+  msg.mode = logicdisplay_getMode();
+  protocol_send(PROTOCOL_ID_DOME_TELEMETRY, &msg, sizeof(msg));
+}
+
+void cmd_ldMode(const uint8_t *payload, uint8_t length)
+{
+  if (length != 1  ||  payload[0] >= LOGICDISPLAY_NUM_MODES)
+    return;
+  logicdisplay_mode((logicdisplay_mode_t) payload[0]);
+}
+
+void cmd_ldText(const uint8_t *payload, uint8_t length)
+{
+  char front_up[3] = "", front_lo[3] = "", rear[6] = "";
+
+  if (length != 9)
+    return;
+
+  memcpy(front_up, &payload[0], 2);
+  memcpy(front_lo, &payload[2], 2);
+  memcpy(rear, &payload[4], 5);
+  logicdisplay_print(front_up, front_lo, rear);
+}
+
 /*
 void ld_change(void)
 {
@@ -36,10 +74,11 @@ void ld_change(void)
 
 int main(void)
 {
-  uart0_println("[INFO ] init UART0");
-  uart0_init();
+  uart0_init(UART0_BAUD_115200);
+  protocol_init(); // frames only, messages via protocol_log_P
+  dispatch_init();
 
-  uart0_println("[INFO ] init logic display");
+  protocol_log_P(PROTOCOL_LOG_INFO, PSTR("init logic display"));
   logicdisplay_init();
 /*
   logicdisplay_mode(LOGICDISPLAY_CHAR);
@@ -49,7 +88,7 @@ int main(void)
   logicdisplay_mode(LOGICDISPLAY_CHASER);
 */
 
-  uart0_println("[INFO ] init alive LED");
+  protocol_log_P(PROTOCOL_LOG_INFO, PSTR("init alive LED"));
   gpt_resolution_t res = gpt_init(MS1);
   DDRB |= (1<<PB7);
   switch(res) {
@@ -60,15 +99,30 @@ int main(void)
     gpt_requestTimer(10000, led_blink);
     break;
   default:
-    uart0_println("[ERROR] initializing alive LED - unknown resolution");
+    protocol_log_P(PROTOCOL_LOG_ERROR, PSTR("alive LED: unknown resolution"));
     break;
   }
 
-  uart0_println("[INFO ] initialization done");
-  uart0_println("[INFO ] start main loop ...");
+  protocol_log_P(PROTOCOL_LOG_INFO, PSTR("init protocol handlers"));
+  protocol_registerHandler(PROTOCOL_ID_LD_MODE, cmd_ldMode);
+  protocol_registerHandler(PROTOCOL_ID_LD_TEXT, cmd_ldText);
+  gpt_requestTimerDeferred(res == US100 ? 1000 : 100, 6, telemetry);
+
+  protocol_log_P(PROTOCOL_LOG_INFO, PSTR("initialization done"));
 
   while(1) {
-    //sleep_mode();
+    dispatch();
+    protocol_poll();
+
+    // sleep until the next interrupt, unless an event or frame is pending
+    cli();
+    if (!dispatch_pending() && !protocol_pending()) {
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+    }
+    sei();
   }
 
   return 0;